@@ -0,0 +1,87 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+#include <vector>
+#include <taskflow/taskflow.hpp>
+#include "Matrix.h"
+
+/// <summary>
+/// Many independent products scheduled across the workers instead of one after another. Every product is a task
+/// of one taskflow, emplaced largest first so big items start early and small ones fill the gaps at the end.
+/// Products below SERIAL_FLOPS run single threaded inside their task, larger ones also split their rows over the
+/// workers through the nested Matrix::multiplyViews, which joins in with corun, giving two levels of parallelism.
+/// </summary>
+namespace batch {
+	constexpr double SERIAL_FLOPS = 2.0 * 192 * 192 * 192; //Below this a product is not worth splitting
+
+	inline double flops(const Matrix& a, const Matrix& b) {
+		return 2.0 * a.getRows() * a.getCols() * b.getCols();
+	}
+
+	/// <summary>
+	/// out = a * b on the calling thread only
+	/// </summary>
+	inline void multiplySerial(const Matrix& a, const Matrix& b, Matrix& out) {
+		out.resize(a.getRows(), b.getCols());
+		gemm::multiply(gemm::Operand{ a.view(), false }, gemm::Operand{ b.view(), false }, out.view(), 1, 0,
+			[](int count, auto&& body) {
+				for (int i = 0; i < count; i++)
+					body(i);
+			});
+	}
+
+	/// <summary>
+	/// Item indices ordered by decreasing cost
+	/// </summary>
+	inline std::vector<size_t> largestFirst(const std::vector<Matrix>& a, const std::vector<Matrix>& b) {
+		std::vector<size_t> order(a.size());
+		std::iota(order.begin(), order.end(), (size_t)0);
+		std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+			return flops(a[x], b[x]) > flops(a[y], b[y]);
+			});
+		return order;
+	}
+
+	inline bool checkSizes(const std::vector<Matrix>& a, const std::vector<Matrix>& b) {
+		if (a.size() != b.size()) {
+			std::printf("Batch sizes are not matched, multiplication not possible.");
+			return false;
+		}
+		for (size_t n = 0; n < a.size(); n++) {
+			if (a[n].getCols() != b[n].getRows()) {
+				std::printf("Matrix sizes are not matched, multiplication not possible.");
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+/// <summary>
+/// out[n] = a[n] * b[n] for every n. out is resized to the batch, buffers of the right shape are reused.
+/// out must not share elements with a or b.
+/// </summary>
+/// <returns>false if the batches or any pair of shapes do not match, out is then left unchanged</returns>
+inline bool batchMultiply(const std::vector<Matrix>& a, const std::vector<Matrix>& b, std::vector<Matrix>& out) {
+	if (!batch::checkSizes(a, b))
+		return false;
+	if (out.size() > a.size())
+		out.erase(out.begin() + a.size(), out.end());
+	while (out.size() < a.size())
+		out.emplace_back(0, 0);
+
+	tf::Taskflow taskflow;
+	for (size_t n : batch::largestFirst(a, b)) {
+		taskflow.emplace([&, n]() {
+			if (batch::flops(a[n], b[n]) < batch::SERIAL_FLOPS) {
+				batch::multiplySerial(a[n], b[n], out[n]);
+			} else {
+				out[n].resize(a[n].getRows(), b[n].getCols());
+				Matrix::multiplyViews(gemm::Operand{ a[n].view(), false }, gemm::Operand{ b[n].view(), false }, out[n].view());
+			}
+			});
+	}
+	Matrix::context().run(taskflow);
+	return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdio>
+#include <deque>
+#include <vector>
+#include <taskflow/taskflow.hpp>
+#include "Matrix.h"
+
+/// <summary>
+/// Product of a chain of matrices by a balanced tree reduction. Neighbouring pairs are multiplied concurrently,
+/// then pairs of their results and so on, so the depth is log2(n) products instead of n - 1. The tree is a
+/// taskflow: every inner node is a task that multiplies its two children, frees their results and precedes
+/// its parent. The order of the factors is kept, only the parenthesization changes.
+/// </summary>
+namespace chain {
+	inline bool checkSizes(const std::vector<Matrix>& factors) {
+		for (size_t n = 1; n < factors.size(); n++) {
+			if (factors[n - 1].getCols() != factors[n].getRows()) {
+				std::printf("Matrix sizes are not matched, multiplication not possible.");
+				return false;
+			}
+		}
+		return true;
+	}
+
+	struct Node {
+		const Matrix* value; //A factor for leaves, the node's own result for inner nodes
+		Matrix* owned;       //The node's result, released once the parent has used it. Null for leaves.
+		tf::Task task;       //Empty for leaves
+	};
+
+	/// <summary>
+	/// Adds the tasks for factors [first, last) to the taskflow, results of inner nodes are kept in storage
+	/// </summary>
+	inline Node build(const std::vector<Matrix>& factors, size_t first, size_t last, tf::Taskflow& taskflow,
+		std::deque<Matrix>& storage) {
+		if (last - first == 1)
+			return Node{ &factors[first], nullptr, tf::Task() };
+		const size_t middle = first + (last - first) / 2;
+		Node left = build(factors, first, middle, taskflow, storage);
+		Node right = build(factors, middle, last, taskflow, storage);
+		storage.emplace_back(0, 0);
+		Matrix* result = &storage.back();
+		tf::Task task = taskflow.emplace([result, left, right]() {
+			Matrix::multiplyInto(*result, *left.value, *right.value);
+			if (left.owned)
+				*left.owned = Matrix(0, 0);
+			if (right.owned)
+				*right.owned = Matrix(0, 0);
+			});
+		if (!left.task.empty())
+			left.task.precede(task);
+		if (!right.task.empty())
+			right.task.precede(task);
+		return Node{ result, result, task };
+	}
+}
+
+/// <summary>
+/// factors[0] * factors[1] * ... * factors[n - 1], 0x0 for an empty chain or mismatched sizes
+/// </summary>
+inline Matrix chainProduct(const std::vector<Matrix>& factors) {
+	if (factors.empty() || !chain::checkSizes(factors))
+		return Matrix(0, 0);
+	if (factors.size() == 1)
+		return factors[0];
+
+	tf::Taskflow taskflow;
+	std::deque<Matrix> storage; //deque keeps node results in place while the tree is built
+	chain::build(factors, 0, factors.size(), taskflow, storage);
+	Matrix::context().run(taskflow);
+	return std::move(storage.back()); //The root is built last
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Parsed command line of the form: program [command] [argument...] [--flag value | --flag=value | --switch]...
+/// Flags may appear anywhere after the program name. Only names listed as switches stand alone, every other
+/// flag takes the next word as its value. Malformed input is collected as errors instead of stopping the
+/// parse, so a driver can print all of them together with its usage.
+/// </summary>
+class CommandLine {
+	std::string command;
+	std::vector<std::string> arguments;
+	std::map<std::string, std::string> flags;
+	mutable std::vector<std::string> errors;
+
+	static bool parseInt64(const std::string& text, long long& value) {
+		if (text.empty())
+			return false;
+		char* end = nullptr;
+		errno = 0;
+		value = std::strtoll(text.c_str(), &end, 10);
+		return errno == 0 && *end == '\0';
+	}
+
+public:
+	CommandLine(int argc, char** argv, const std::vector<std::string>& switches = {}) {
+		for (int i = 1; i < argc; i++) {
+			const std::string word = argv[i];
+			if (word.size() > 2 && word.compare(0, 2, "--") == 0) {
+				std::string name = word.substr(2);
+				const size_t equals = name.find('=');
+				if (equals != std::string::npos) {
+					flags[name.substr(0, equals)] = name.substr(equals + 1);
+					continue;
+				}
+				bool isSwitch = false;
+				for (const std::string& s : switches)
+					isSwitch = isSwitch || s == name;
+				if (isSwitch)
+					flags[name] = "1";
+				else if (i + 1 < argc)
+					flags[name] = argv[++i];
+				else
+					errors.push_back("--" + name + " needs a value");
+			} else if (command.empty()) {
+				command = word;
+			} else {
+				arguments.push_back(word);
+			}
+		}
+	}
+
+	const std::string& getCommand() const { return command; }
+	const std::vector<std::string>& getArguments() const { return arguments; }
+
+	bool has(const std::string& name) const { return flags.count(name) != 0; }
+
+	std::string getString(const std::string& name, const std::string& fallback = "") const {
+		auto found = flags.find(name);
+		return found == flags.end() ? fallback : found->second;
+	}
+
+	/// <summary>
+	/// Integer value of --name, fallback if absent. A value that is not an integer in [min, max] is an error.
+	/// </summary>
+	long long getInt(const std::string& name, long long fallback, long long min = 0, long long max = INT32_MAX) const {
+		if (!has(name))
+			return fallback;
+		long long value = 0;
+		if (!parseInt64(getString(name), value) || value < min || value > max) {
+			errors.push_back("--" + name + " expects an integer in [" + std::to_string(min) + ", " + std::to_string(max) +
+				"], got " + getString(name));
+			return fallback;
+		}
+		return value;
+	}
+
+	/// <summary>
+	/// Comma separated words of --name, fallback if absent
+	/// </summary>
+	std::vector<std::string> getList(const std::string& name, const std::vector<std::string>& fallback = {}) const {
+		if (!has(name))
+			return fallback;
+		std::vector<std::string> items;
+		const std::string text = getString(name);
+		size_t start = 0;
+		while (start <= text.size()) {
+			const size_t comma = std::min(text.find(',', start), text.size());
+			if (comma > start)
+				items.push_back(text.substr(start, comma - start));
+			start = comma + 1;
+		}
+		return items;
+	}
+
+	/// <summary>
+	/// Comma separated integers of --name in [min, max], fallback if absent
+	/// </summary>
+	std::vector<int> getInts(const std::string& name, const std::vector<int>& fallback, long long min = 0,
+		long long max = INT32_MAX) const {
+		if (!has(name))
+			return fallback;
+		std::vector<int> values;
+		for (const std::string& item : getList(name)) {
+			long long value = 0;
+			if (!parseInt64(item, value) || value < min || value > max) {
+				errors.push_back("--" + name + " expects integers in [" + std::to_string(min) + ", " + std::to_string(max) +
+					"], got " + item);
+				return fallback;
+			}
+			values.push_back((int)value);
+		}
+		if (values.empty())
+			errors.push_back("--" + name + " is empty");
+		return values.empty() ? fallback : values;
+	}
+
+	/// <summary>
+	/// Records an error for every flag not in known
+	/// </summary>
+	void allowOnly(const std::vector<std::string>& known) const {
+		for (const auto& flag : flags) {
+			bool found = false;
+			for (const std::string& name : known)
+				found = found || name == flag.first;
+			if (!found)
+				errors.push_back("unknown flag --" + flag.first);
+		}
+	}
+
+	void addError(const std::string& message) const { errors.push_back(message); }
+
+	bool ok() const { return errors.empty(); }
+
+	void printErrors() const {
+		for (const std::string& error : errors)
+			std::printf("error: %s\n", error.c_str());
+	}
+};
@@ -0,0 +1,143 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+/// <summary>
+/// Brain floating point storage: the top 16 bits of a float, 8 exponent bits and 7 mantissa bits.
+/// Only used for storage, arithmetic is done in float.
+/// </summary>
+struct bf16 {
+	uint16_t bits = 0;
+
+	static bf16 fromFloat(float f) {
+		uint32_t x;
+		std::memcpy(&x, &f, sizeof(x));
+		bf16 result;
+		if ((x & 0x7FFFFFFF) > 0x7F800000)
+			result.bits = (uint16_t)((x >> 16) | 0x0040); //Keep NaN a quiet NaN
+		else
+			result.bits = (uint16_t)((x + 0x7FFF + ((x >> 16) & 1)) >> 16); //Round to nearest even
+		return result;
+	}
+
+	float toFloat() const {
+		const uint32_t x = (uint32_t)bits << 16;
+		float f;
+		std::memcpy(&f, &x, sizeof(f));
+		return f;
+	}
+};
+
+/// <summary>
+/// IEEE 754 half precision storage: 5 exponent bits and 10 mantissa bits, largest finite value 65504.
+/// Only used for storage, arithmetic is done in float.
+/// </summary>
+struct fp16 {
+	uint16_t bits = 0;
+
+	static fp16 fromFloat(float f) {
+		uint32_t x;
+		std::memcpy(&x, &f, sizeof(x));
+		const uint32_t sign = (x >> 16) & 0x8000;
+		const uint32_t abs = x & 0x7FFFFFFF;
+		fp16 result;
+		if (abs >= 0x7F800000) {
+			result.bits = (uint16_t)(sign | (abs > 0x7F800000 ? 0x7E00 : 0x7C00));
+		} else if (abs >= 0x477FF000) {
+			result.bits = (uint16_t)(sign | 0x7C00); //65520 and up round to infinity
+		} else if (abs < 0x38800000) {
+			//Below the smallest normal half, the value in units of 2^-24 rounded to nearest even
+			float a;
+			std::memcpy(&a, &abs, sizeof(a));
+			result.bits = (uint16_t)(sign | (uint32_t)std::nearbyint(a * 16777216.0f));
+		} else {
+			//Rebias the exponent from 127 to 15 and round the mantissa to nearest even
+			result.bits = (uint16_t)(sign | ((abs + 0xC8000FFF + ((abs >> 13) & 1)) >> 13));
+		}
+		return result;
+	}
+
+	float toFloat() const {
+		const uint32_t sign = (uint32_t)(bits & 0x8000) << 16;
+		const uint32_t exponent = (bits >> 10) & 0x1F;
+		const uint32_t mantissa = bits & 0x3FF;
+		uint32_t x;
+		if (exponent == 0) {
+			const float f = mantissa * (1.0f / 16777216.0f);
+			std::memcpy(&x, &f, sizeof(x));
+			x |= sign;
+		} else if (exponent == 31) {
+			x = sign | 0x7F800000 | (mantissa << 13);
+		} else {
+			x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		}
+		float f;
+		std::memcpy(&f, &x, sizeof(f));
+		return f;
+	}
+};
+
+/// <summary>
+/// Per element type properties used by TypedMatrix. Compute is the type products are accumulated in,
+/// randomScale the half width of the range random matrices are drawn from.
+/// </summary>
+template<typename T>
+struct ElementTraits;
+
+template<>
+struct ElementTraits<double> {
+	using Compute = double;
+	static constexpr const char* name = "double";
+	static constexpr double randomScale = 1;
+	static Compute toCompute(double v) { return v; }
+	static double fromCompute(Compute v) { return v; }
+	static double fromDouble(double v) { return v; }
+	static double toDouble(double v) { return v; }
+};
+
+template<>
+struct ElementTraits<float> {
+	using Compute = float;
+	static constexpr const char* name = "float";
+	static constexpr double randomScale = 1;
+	static Compute toCompute(float v) { return v; }
+	static float fromCompute(Compute v) { return v; }
+	static float fromDouble(double v) { return (float)v; }
+	static double toDouble(float v) { return v; }
+};
+
+//int32 products wrap modulo 2^32. They are accumulated as uint32_t, which gives the same low 32 bits
+//as a wider accumulator with defined overflow and keeps the kernel in 32 bit SIMD lanes.
+template<>
+struct ElementTraits<int32_t> {
+	using Compute = uint32_t;
+	static constexpr const char* name = "int32";
+	static constexpr double randomScale = 16;
+	static Compute toCompute(int32_t v) { return (uint32_t)v; }
+	static int32_t fromCompute(Compute v) { return (int32_t)v; }
+	static int32_t fromDouble(double v) { return (int32_t)std::floor(v); }
+	static double toDouble(int32_t v) { return v; }
+};
+
+template<>
+struct ElementTraits<bf16> {
+	using Compute = float;
+	static constexpr const char* name = "bf16";
+	static constexpr double randomScale = 1;
+	static Compute toCompute(bf16 v) { return v.toFloat(); }
+	static bf16 fromCompute(Compute v) { return bf16::fromFloat(v); }
+	static bf16 fromDouble(double v) { return bf16::fromFloat((float)v); }
+	static double toDouble(bf16 v) { return v.toFloat(); }
+};
+
+template<>
+struct ElementTraits<fp16> {
+	using Compute = float;
+	static constexpr const char* name = "fp16";
+	static constexpr double randomScale = 1;
+	static Compute toCompute(fp16 v) { return v.toFloat(); }
+	static fp16 fromCompute(Compute v) { return fp16::fromFloat(v); }
+	static fp16 fromDouble(double v) { return fp16::fromFloat((float)v); }
+	static double toDouble(fp16 v) { return v.toFloat(); }
+};
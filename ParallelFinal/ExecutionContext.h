@@ -0,0 +1,210 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <taskflow/taskflow.hpp>
+#include "Partition.h"
+#include "Trace.h"
+
+/// <summary>
+/// Records every task the executor runs as a span on its worker's row of the trace. Tasks nested through
+/// corun are kept on a per worker stack, so inner and outer tasks both get their own span.
+/// </summary>
+class TaskTraceObserver : public tf::ObserverInterface {
+	std::vector<std::vector<int64_t>> begins;
+	std::vector<char> named;
+
+public:
+	void set_up(size_t workers) override {
+		begins.assign(workers, {});
+		named.assign(workers, 0);
+	}
+
+	void on_entry(tf::WorkerView worker, tf::TaskView) override {
+		const size_t id = worker.id();
+		if (!named[id]) {
+			trace::Recorder::global().nameThread("taskflow worker " + std::to_string(id));
+			named[id] = 1;
+		}
+		begins[id].push_back(trace::Recorder::global().now());
+	}
+
+	void on_exit(tf::WorkerView worker, tf::TaskView task) override {
+		std::vector<int64_t>& stack = begins[worker.id()];
+		if (stack.empty())
+			return;
+		const int64_t begin = stack.back();
+		stack.pop_back();
+		if (trace::enabled())
+			trace::Recorder::global().record(task.name().empty() ? "task" : task.name(), "task", begin,
+				trace::Recorder::global().now());
+	}
+};
+
+/// <summary>
+/// Owns the tf::Executor used by Matrix operations so worker threads are started once, not per call.
+/// A process wide instance is used by default, a different one can be injected with Matrix::setContext.
+/// </summary>
+class ExecutionContext {
+	std::unique_ptr<tf::Executor> executor;
+	partition::Policy policy;
+	std::shared_ptr<TaskTraceObserver> observer;
+
+public:
+	/// <param name="workers">Number of worker threads, 0 uses the hardware concurrency</param>
+	explicit ExecutionContext(size_t workers = 0) {
+		setThreads(workers);
+	}
+
+	ExecutionContext(const ExecutionContext&) = delete;
+	ExecutionContext& operator=(const ExecutionContext&) = delete;
+
+	/// <summary>
+	/// Replaces the executor with one of the given size. Must not be called while work is running on it.
+	/// </summary>
+	void setThreads(size_t workers) {
+		if (workers == 0)
+			workers = std::max(1u, std::thread::hardware_concurrency());
+		const bool tracing = isTracing();
+		observer.reset();
+		executor.reset();
+		executor = std::make_unique<tf::Executor>(workers);
+		setTracing(tracing);
+	}
+
+	/// <summary>
+	/// Attaches or removes the observer that records the executor's tasks, see Trace.h. Events are only
+	/// stored between trace::Recorder::start and stop.
+	/// </summary>
+	void setTracing(bool on) {
+		if (on && !observer) {
+			observer = executor->make_observer<TaskTraceObserver>();
+		} else if (!on && observer) {
+			executor->remove_observer(observer);
+			observer.reset();
+		}
+	}
+
+	bool isTracing() const { return observer != nullptr; }
+
+	size_t numThreads() const { return executor->num_workers(); }
+
+	tf::Executor& getExecutor() { return *executor; }
+
+	/// <summary>
+	/// Runs a taskflow to completion. From inside one of this executor's workers the calling
+	/// worker joins in with corun instead of blocking, so nested Matrix operations cannot deadlock.
+	/// </summary>
+	void run(tf::Taskflow& taskflow) {
+		if (executor->this_worker_id() >= 0)
+			executor->corun(taskflow);
+		else
+			executor->run(taskflow).wait();
+	}
+
+	/// <summary>
+	/// Policy used by parallelFor when none is passed. Like setThreads, must not change while work is running.
+	/// </summary>
+	void setPolicy(const partition::Policy& policy) { this->policy = policy; }
+	const partition::Policy& getPolicy() const { return policy; }
+
+	/// <summary>
+	/// Sets the context's policy for the lifetime of the scope and restores the previous one afterwards
+	/// </summary>
+	class PolicyScope {
+		ExecutionContext& context;
+		partition::Policy previous;
+	public:
+		PolicyScope(ExecutionContext& context, const partition::Policy& policy) : context(context), previous(context.policy) {
+			context.policy = policy;
+		}
+		~PolicyScope() { context.policy = previous; }
+		PolicyScope(const PolicyScope&) = delete;
+		PolicyScope& operator=(const PolicyScope&) = delete;
+	};
+
+	/// <summary>
+	/// Calls body(i) for i in [0, count) in parallel, chunked by the context's policy
+	/// </summary>
+	template<typename F>
+	void parallelFor(int count, F&& body) {
+		parallelFor(count, body, policy);
+	}
+
+	/// <summary>
+	/// Calls body(i) for i in [0, count) in parallel, chunked by the given policy. While tracing, every index
+	/// is recorded as a chunk of this loop and the caller records a span over the whole loop.
+	/// </summary>
+	template<typename F>
+	void parallelFor(int count, F&& body, const partition::Policy& with) {
+		if (!trace::enabled()) {
+			partitionedFor(count, body, with);
+			return;
+		}
+		trace::Recorder& recorder = trace::Recorder::global();
+		const int64_t loop = recorder.nextLoop();
+		const int64_t begin = recorder.now();
+		partitionedFor(count, [&](int i) {
+			const int64_t start = recorder.now();
+			body(i);
+			recorder.record("chunk", "chunk", start, recorder.now(), loop);
+			}, with);
+		recorder.record("parallelFor", "loop", begin, recorder.now(), loop);
+	}
+
+	/// <summary>
+	/// parallelFor without tracing. Taskflow has no affinity partitioner, Affinity uses the static one,
+	/// which hands out the same chunks every run.
+	/// </summary>
+	template<typename F>
+	void partitionedFor(int count, F&& body, const partition::Policy& with) {
+		if (count <= 0)
+			return;
+		if (count == 1) {
+			body(0);
+			return;
+		}
+		tf::Taskflow taskflow;
+		auto each = [&](int i) { body(i); };
+		const size_t grain = (size_t)std::max(0, with.grain);
+		switch (with.kind) {
+		case partition::Kind::Static:
+		case partition::Kind::Affinity:
+			taskflow.for_each_index(0, count, 1, each, tf::StaticPartitioner(grain));
+			break;
+		case partition::Kind::Dynamic:
+			taskflow.for_each_index(0, count, 1, each, tf::DynamicPartitioner(std::max<size_t>(1, grain)));
+			break;
+		case partition::Kind::Guided:
+			taskflow.for_each_index(0, count, 1, each, tf::GuidedPartitioner(grain));
+			break;
+		default:
+			if (grain > 0)
+				taskflow.for_each_index(0, count, 1, each, tf::GuidedPartitioner(grain));
+			else
+				taskflow.for_each_index(0, count, 1, each);
+			break;
+		}
+		run(taskflow);
+	}
+
+	/// <summary>
+	/// Calls body(firstRow, lastRow, firstCol, lastCol) over tiles covering a rows x cols loop, see partition::tiling
+	/// </summary>
+	template<typename F>
+	void parallelFor2D(int rows, int cols, F&& body) {
+		const partition::Tiling tiles = partition::tiling(rows, cols, numThreads());
+		parallelFor(tiles.count(), [&](int t) { tiles.apply(t, body); });
+	}
+
+	/// <summary>
+	/// Name of the backend in benchmark output
+	/// </summary>
+	static const char* backendName() { return "taskflow"; }
+
+	static ExecutionContext& global() {
+		static ExecutionContext context;
+		return context;
+	}
+};
@@ -0,0 +1,478 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <utility>
+#include <vector>
+#include "Matrix.h"
+#include "TaskGraph.h"
+
+/// <summary>
+/// Tiled LU with partial pivoting, Cholesky, triangular solves and the inverse. The matrix is cut into
+/// tile x tile blocks and every step of an algorithm on a block is a task of a TaskGraph, with edges inferred
+/// from the tiles each task reads and writes. A panel is factored as soon as its own column has received the
+/// previous step's update, overlapping the rest of that update instead of waiting for a bulk synchronous
+/// phase to end. Tile kernels are serial, the parallelism comes from running independent tiles at once.
+/// </summary>
+namespace factor {
+	constexpr int TILE = 128;
+
+	/// <summary>
+	/// Triangle of a square matrix used by a triangular solve
+	/// </summary>
+	enum class Triangle {
+		Lower,          //L X = B
+		UnitLower,      //L X = B with an implied unit diagonal, the L of an LU factorization
+		Upper,          //U X = B
+		LowerTransposed //L^T X = B with L stored in the lower triangle, the second half of a Cholesky solve
+	};
+
+	/// <summary>
+	/// Serial kernels on single tiles or panels, row major so every inner loop runs along a row
+	/// </summary>
+	namespace kernel {
+		/// <summary>
+		/// Swaps row r with row pivots[r] for r in [first, last)
+		/// </summary>
+		inline void applySwaps(MatrixView<double> a, const int* pivots, int first, int last) {
+			for (int r = first; r < last; r++) {
+				if (pivots[r] != r)
+					std::swap_ranges(a.rowPtr(r), a.rowPtr(r) + a.cols, a.rowPtr(pivots[r]));
+			}
+		}
+
+		/// <summary>
+		/// b = op(t)^-1 * b, t square
+		/// </summary>
+		inline void solve(Triangle which, MatrixView<const double> t, MatrixView<double> b) {
+			const int n = t.rows;
+			auto axpy = [&](double f, int from, int to) {
+				const double* x = b.rowPtr(from);
+				double* y = b.rowPtr(to);
+				for (int j = 0; j < b.cols; j++)
+					y[j] -= f * x[j];
+			};
+			auto scale = [&](int i) {
+				const double inverse = 1 / t(i, i);
+				double* row = b.rowPtr(i);
+				for (int j = 0; j < b.cols; j++)
+					row[j] *= inverse;
+			};
+			if (which == Triangle::Lower || which == Triangle::UnitLower) {
+				for (int i = 0; i < n; i++) {
+					for (int k = 0; k < i; k++)
+						axpy(t(i, k), k, i);
+					if (which == Triangle::Lower)
+						scale(i);
+				}
+			} else {
+				for (int i = n - 1; i >= 0; i--) {
+					for (int k = i + 1; k < n; k++)
+						axpy(which == Triangle::Upper ? t(i, k) : t(k, i), k, i);
+					scale(i);
+				}
+			}
+		}
+
+		/// <summary>
+		/// b = b * l^-T, l lower triangular
+		/// </summary>
+		inline void solveRightLowerTransposed(MatrixView<const double> l, MatrixView<double> b) {
+			for (int r = 0; r < b.rows; r++) {
+				double* row = b.rowPtr(r);
+				for (int j = 0; j < l.rows; j++) {
+					const double* lj = l.rowPtr(j);
+					double sum = row[j];
+					for (int k = 0; k < j; k++)
+						sum -= row[k] * lj[k];
+					row[j] = sum / lj[j];
+				}
+			}
+		}
+
+		/// <summary>
+		/// c -= op(a) * op(b)
+		/// </summary>
+		inline void update(gemm::Operand a, gemm::Operand b, MatrixView<double> c) {
+			gemm::multiply(a, b, c, -1, 1, [](int count, auto&& body) {
+				for (int i = 0; i < count; i++)
+					body(i);
+				});
+		}
+
+		/// <summary>
+		/// LU with partial pivoting of a panel with at least as many rows as columns, in place. pivots[c] is the
+		/// panel row that was swapped with row c. Recursive (Toledo): the left half is factored, applied to the
+		/// right half by a triangular solve and a product, and the lower right quarter is factored in turn.
+		/// A zero pivot column is skipped like LAPACK does.
+		/// </summary>
+		/// <returns>false if a pivot was zero, the matrix is then singular</returns>
+		inline bool luPanel(MatrixView<double> a, int* pivots) {
+			const int steps = std::min(a.rows, a.cols);
+			if (steps <= 8) {
+				bool regular = true;
+				for (int c = 0; c < steps; c++) {
+					int p = c;
+					for (int i = c + 1; i < a.rows; i++) {
+						if (std::abs(a(i, c)) > std::abs(a(p, c)))
+							p = i;
+					}
+					pivots[c] = p;
+					if (a(p, c) == 0) {
+						regular = false;
+						continue;
+					}
+					if (p != c)
+						std::swap_ranges(a.rowPtr(c), a.rowPtr(c) + a.cols, a.rowPtr(p));
+					const double inverse = 1 / a(c, c);
+					const double* pivotRow = a.rowPtr(c);
+					for (int i = c + 1; i < a.rows; i++) {
+						double* row = a.rowPtr(i);
+						const double l = row[c] *= inverse;
+						for (int j = c + 1; j < a.cols; j++)
+							row[j] -= l * pivotRow[j];
+					}
+				}
+				return regular;
+			}
+
+			const int half = steps / 2;
+			bool regular = luPanel(a.block(0, 0, a.rows, half), pivots);
+			MatrixView<double> right = a.block(0, half, a.rows, a.cols - half);
+			applySwaps(right, pivots, 0, half);
+			solve(Triangle::UnitLower, a.block(0, 0, half, half), right.block(0, 0, half, right.cols));
+			update(gemm::Operand{ a.block(half, 0, a.rows - half, half), false },
+				gemm::Operand{ right.block(0, 0, half, right.cols), false }, right.block(half, 0, a.rows - half, right.cols));
+			regular = luPanel(right.block(half, 0, a.rows - half, right.cols), pivots + half) && regular;
+			for (int c = half; c < steps; c++)
+				pivots[c] += half;
+			applySwaps(a.block(0, 0, a.rows, half), pivots, half, steps);
+			return regular;
+		}
+
+		/// <summary>
+		/// Lower Cholesky factor of a symmetric tile in place, the upper triangle is zeroed
+		/// </summary>
+		/// <returns>false if the tile is not positive definite</returns>
+		inline bool cholesky(MatrixView<double> a) {
+			for (int j = 0; j < a.rows; j++) {
+				const double* lj = a.rowPtr(j);
+				double d = lj[j];
+				for (int k = 0; k < j; k++)
+					d -= lj[k] * lj[k];
+				if (!(d > 0))
+					return false;
+				const double l = std::sqrt(d);
+				a(j, j) = l;
+				for (int i = j + 1; i < a.rows; i++) {
+					double* li = a.rowPtr(i);
+					double sum = li[j];
+					for (int k = 0; k < j; k++)
+						sum -= li[k] * lj[k];
+					li[j] = sum / l;
+				}
+				std::fill(a.rowPtr(j) + j + 1, a.rowPtr(j) + a.cols, 0.0);
+			}
+			return true;
+		}
+	}
+
+	/// <summary>
+	/// Builds a TaskGraph from the data each task touches. Data items are numbered by the caller, usually one
+	/// per tile. A task runs after the last writer of every item it reads or writes, and a writer also after
+	/// every reader since that write, so tasks are added in program order and the graph keeps its meaning.
+	/// </summary>
+	class TileGraph {
+		TaskGraph graph;
+		std::vector<int> writer;              //Last task writing each item, -1 for none
+		std::vector<std::vector<int>> readers; //Tasks reading each item since its last write
+
+	public:
+		TileGraph(ExecutionContext& ctx, int items) : graph(ctx), writer(items, -1), readers(items) {}
+
+		template<typename F>
+		void add(const char* name, const std::vector<int>& reads, const std::vector<int>& writes, F&& body) {
+			const int task = graph.add(name, std::forward<F>(body));
+			std::vector<int> before;
+			for (int item : reads) {
+				if (writer[item] >= 0)
+					before.push_back(writer[item]);
+			}
+			for (int item : writes) {
+				if (writer[item] >= 0)
+					before.push_back(writer[item]);
+				before.insert(before.end(), readers[item].begin(), readers[item].end());
+			}
+			std::sort(before.begin(), before.end());
+			before.erase(std::unique(before.begin(), before.end()), before.end());
+			for (int b : before)
+				graph.precede(b, task);
+			for (int item : reads)
+				readers[item].push_back(task);
+			for (int item : writes) {
+				writer[item] = task;
+				readers[item].clear();
+			}
+		}
+
+		int size() const { return graph.size(); }
+
+		void run() { graph.run(); }
+	};
+
+	/// <summary>
+	/// Rows or columns in tile t of an n long dimension
+	/// </summary>
+	inline int tileSpan(int n, int tile, int t) { return std::min(tile, n - t * tile); }
+
+	/// <summary>
+	/// Adds the tasks of b = op(t)^-1 * b. Tile (i, c) of b is item i * colTiles + c.
+	/// Forward substitution walks the row tiles down, backward substitution walks them up.
+	/// </summary>
+	inline void addSolve(TileGraph& graph, Triangle which, MatrixView<const double> t, MatrixView<double> b, int tile) {
+		const int n = t.rows;
+		const int rowTiles = (n + tile - 1) / tile;
+		const int colTiles = (b.cols + tile - 1) / tile;
+		const bool forward = which == Triangle::Lower || which == Triangle::UnitLower;
+		const gemm::Operand op{ t, which == Triangle::LowerTransposed };
+		for (int c = 0; c < colTiles; c++) {
+			const int c0 = c * tile, cb = tileSpan(b.cols, tile, c);
+			for (int step = 0; step < rowTiles; step++) {
+				const int k = forward ? step : rowTiles - 1 - step;
+				const int k0 = k * tile, kb = tileSpan(n, tile, k);
+				graph.add("solve diagonal", {}, { k * colTiles + c }, [=]() {
+					kernel::solve(which, t.block(k0, k0, kb, kb), b.block(k0, c0, kb, cb));
+					});
+				for (int i = forward ? k + 1 : 0; i < (forward ? rowTiles : k); i++) {
+					const int i0 = i * tile, ib = tileSpan(n, tile, i);
+					graph.add("solve update", { k * colTiles + c }, { i * colTiles + c }, [=]() {
+						kernel::update(op.block(i0, k0, ib, kb), gemm::Operand{ b.block(k0, c0, kb, cb), false },
+							b.block(i0, c0, ib, cb));
+						});
+				}
+			}
+		}
+	}
+
+	/// <summary>
+	/// P A = L U with partial pivoting. factors holds L below the diagonal, its unit diagonal implied, and U on
+	/// and above it. Row i was swapped with row pivots[i] at step i, in that order, as in LAPACK getrf.
+	/// </summary>
+	/// <returns>false if a is not square or is singular, factors and pivots are then left unchanged</returns>
+	inline bool lu(const Matrix& a, Matrix& factors, std::vector<int>& pivots, int tile = TILE) {
+		if (a.getRows() != a.getCols()) {
+			std::printf("Matrix is not square, LU decomposition not possible.");
+			return false;
+		}
+		const int n = a.getRows();
+		tile = std::max(1, tile);
+		const int tiles = (n + tile - 1) / tile;
+		Matrix work(a);
+		const MatrixView<double> m = work.view();
+		std::vector<int> swaps(n); //Panel relative until the graph has run
+		int* const local = swaps.data();
+		std::atomic<bool> singular{ false };
+
+		//Tile (i, j) is item i * tiles + j, the pivots of panel k are item tiles * tiles + k
+		TileGraph graph(Matrix::context(), tiles * tiles + tiles);
+		auto item = [tiles](int i, int j) { return i * tiles + j; };
+		for (int k = 0; k < tiles; k++) {
+			const int k0 = k * tile, kb = tileSpan(n, tile, k);
+			std::vector<int> panel{ tiles * tiles + k };
+			for (int i = k; i < tiles; i++)
+				panel.push_back(item(i, k));
+			graph.add("lu panel", {}, panel, [=, &singular]() {
+				if (!kernel::luPanel(m.block(k0, k0, n - k0, kb), local + k0))
+					singular = true;
+				});
+			for (int j = k + 1; j < tiles; j++) {
+				const int j0 = j * tile, jb = tileSpan(n, tile, j);
+				std::vector<int> column;
+				for (int i = k; i < tiles; i++)
+					column.push_back(item(i, j));
+				graph.add("lu swap solve", { item(k, k), tiles * tiles + k }, column, [=]() {
+					const MatrixView<double> c = m.block(k0, j0, n - k0, jb);
+					kernel::applySwaps(c, local + k0, 0, kb);
+					kernel::solve(Triangle::UnitLower, m.block(k0, k0, kb, kb), c.block(0, 0, kb, jb));
+					});
+				for (int i = k + 1; i < tiles; i++) {
+					const int i0 = i * tile, ib = tileSpan(n, tile, i);
+					graph.add("lu update", { item(i, k), item(k, j) }, { item(i, j) }, [=]() {
+						kernel::update(gemm::Operand{ m.block(i0, k0, ib, kb), false },
+							gemm::Operand{ m.block(k0, j0, kb, jb), false }, m.block(i0, j0, ib, jb));
+						});
+				}
+			}
+		}
+		//Later panels' swaps reach back into the L columns left of them once nothing reads those any more
+		for (int j = 0; j + 1 < tiles; j++) {
+			std::vector<int> reads, writes;
+			for (int k = j + 1; k < tiles; k++) {
+				reads.push_back(tiles * tiles + k);
+				writes.push_back(item(k, j));
+			}
+			graph.add("lu left swaps", reads, writes, [=]() {
+				const int j0 = j * tile, jb = tileSpan(n, tile, j);
+				for (int k = j + 1; k < tiles; k++)
+					kernel::applySwaps(m.block(k * tile, j0, n - k * tile, jb), local + k * tile, 0, tileSpan(n, tile, k));
+				});
+		}
+		graph.run();
+
+		if (singular) {
+			std::printf("Matrix is singular, LU decomposition not possible.");
+			return false;
+		}
+		pivots.resize(n);
+		for (int i = 0; i < n; i++)
+			pivots[i] = swaps[i] + i / tile * tile;
+		factors = std::move(work);
+		return true;
+	}
+
+	/// <summary>
+	/// A = L L^T for a symmetric positive definite a, only its lower triangle is read. l gets L with zeros above the diagonal.
+	/// </summary>
+	/// <returns>false if a is not square or not positive definite, l is then left unchanged</returns>
+	inline bool cholesky(const Matrix& a, Matrix& l, int tile = TILE) {
+		if (a.getRows() != a.getCols()) {
+			std::printf("Matrix is not square, Cholesky decomposition not possible.");
+			return false;
+		}
+		const int n = a.getRows();
+		tile = std::max(1, tile);
+		const int tiles = (n + tile - 1) / tile;
+		Matrix work(a);
+		const MatrixView<double> m = work.view();
+		std::atomic<bool> failed{ false };
+
+		TileGraph graph(Matrix::context(), tiles * tiles);
+		auto item = [tiles](int i, int j) { return i * tiles + j; };
+		for (int k = 0; k < tiles; k++) {
+			const int k0 = k * tile, kb = tileSpan(n, tile, k);
+			graph.add("cholesky diagonal", {}, { item(k, k) }, [=, &failed]() {
+				if (!failed && !kernel::cholesky(m.block(k0, k0, kb, kb)))
+					failed = true;
+				});
+			for (int i = k + 1; i < tiles; i++) {
+				const int i0 = i * tile, ib = tileSpan(n, tile, i);
+				graph.add("cholesky solve", { item(k, k) }, { item(i, k) }, [=, &failed]() {
+					if (!failed)
+						kernel::solveRightLowerTransposed(m.block(k0, k0, kb, kb), m.block(i0, k0, ib, kb));
+					});
+			}
+			for (int i = k + 1; i < tiles; i++) {
+				const int i0 = i * tile, ib = tileSpan(n, tile, i);
+				for (int j = k + 1; j <= i; j++) {
+					const int j0 = j * tile, jb = tileSpan(n, tile, j);
+					graph.add("cholesky update", { item(i, k), item(j, k) }, { item(i, j) }, [=, &failed]() {
+						if (!failed)
+							kernel::update(gemm::Operand{ m.block(i0, k0, ib, kb), false },
+								gemm::Operand{ m.block(j0, k0, jb, kb), true }, m.block(i0, j0, ib, jb));
+						});
+				}
+			}
+		}
+		for (int i = 0; i < tiles; i++) {
+			for (int j = i + 1; j < tiles; j++) {
+				graph.add("cholesky zero", {}, { item(i, j) }, [=]() {
+					const MatrixView<double> upper = m.block(i * tile, j * tile, tileSpan(n, tile, i), tileSpan(n, tile, j));
+					for (int r = 0; r < upper.rows; r++)
+						std::fill(upper.rowPtr(r), upper.rowPtr(r) + upper.cols, 0.0);
+					});
+			}
+		}
+		graph.run();
+
+		if (failed) {
+			std::printf("Matrix is not positive definite, Cholesky decomposition not possible.");
+			return false;
+		}
+		l = std::move(work);
+		return true;
+	}
+
+	/// <summary>
+	/// x = op(t)^-1 * b for a triangular t, see Triangle. x may be b.
+	/// </summary>
+	/// <returns>false if the sizes do not match, x is then left unchanged</returns>
+	inline bool solveTriangular(const Matrix& t, Triangle which, const Matrix& b, Matrix& x, int tile = TILE) {
+		if (t.getRows() != t.getCols() || t.getRows() != b.getRows()) {
+			std::printf("Matrix sizes are not matched, solve not possible.");
+			return false;
+		}
+		tile = std::max(1, tile);
+		Matrix work(b);
+		TileGraph graph(Matrix::context(), ((b.getRows() + tile - 1) / tile) * ((b.getCols() + tile - 1) / tile));
+		addSolve(graph, which, t.view(), work.view(), tile);
+		graph.run();
+		x = std::move(work);
+		return true;
+	}
+
+	/// <summary>
+	/// x = A^-1 * b from the factorization lu returned. Each column block of b is permuted and then runs its
+	/// forward and backward substitution on its own, so column blocks and the two sweeps overlap.
+	/// </summary>
+	/// <returns>false if the sizes do not match, x is then left unchanged</returns>
+	inline bool solve(const Matrix& factors, const std::vector<int>& pivots, const Matrix& b, Matrix& x, int tile = TILE) {
+		const int n = factors.getRows();
+		if (factors.getCols() != n || b.getRows() != n || (int)pivots.size() != n) {
+			std::printf("Matrix sizes are not matched, solve not possible.");
+			return false;
+		}
+		tile = std::max(1, tile);
+		const int rowTiles = (n + tile - 1) / tile;
+		const int colTiles = (b.getCols() + tile - 1) / tile;
+		Matrix work(b);
+		const MatrixView<double> m = work.view();
+		const int* const order = pivots.data();
+
+		TileGraph graph(Matrix::context(), rowTiles * colTiles);
+		for (int c = 0; c < colTiles; c++) {
+			std::vector<int> column;
+			for (int i = 0; i < rowTiles; i++)
+				column.push_back(i * colTiles + c);
+			graph.add("solve swaps", {}, column, [=]() {
+				kernel::applySwaps(m.block(0, c * tile, n, tileSpan(m.cols, tile, c)), order, 0, n);
+				});
+		}
+		addSolve(graph, Triangle::UnitLower, factors.view(), m, tile);
+		addSolve(graph, Triangle::Upper, factors.view(), m, tile);
+		graph.run();
+		x = std::move(work);
+		return true;
+	}
+
+	/// <summary>
+	/// x = A^-1 * b from the Cholesky factor l of A
+	/// </summary>
+	/// <returns>false if the sizes do not match, x is then left unchanged</returns>
+	inline bool choleskySolve(const Matrix& l, const Matrix& b, Matrix& x, int tile = TILE) {
+		if (l.getRows() != l.getCols() || l.getRows() != b.getRows()) {
+			std::printf("Matrix sizes are not matched, solve not possible.");
+			return false;
+		}
+		tile = std::max(1, tile);
+		Matrix work(b);
+		TileGraph graph(Matrix::context(), ((b.getRows() + tile - 1) / tile) * ((b.getCols() + tile - 1) / tile));
+		addSolve(graph, Triangle::Lower, l.view(), work.view(), tile);
+		addSolve(graph, Triangle::LowerTransposed, l.view(), work.view(), tile);
+		graph.run();
+		x = std::move(work);
+		return true;
+	}
+
+	/// <summary>
+	/// result = a^-1 through the LU factorization, solving for the identity
+	/// </summary>
+	/// <returns>false if a is not square or is singular, result is then left unchanged</returns>
+	inline bool inverse(const Matrix& a, Matrix& result, int tile = TILE) {
+		Matrix factors(0, 0);
+		std::vector<int> pivots;
+		if (!lu(a, factors, pivots, tile))
+			return false;
+		return solve(factors, pivots, Matrix(a.getRows(), a.getRows()), result, tile);
+	}
+}
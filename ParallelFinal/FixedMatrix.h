@@ -0,0 +1,149 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Matrix.h"
+
+namespace fixed {
+	template<typename F, int... I>
+	inline void unrollSequence(F& f, std::integer_sequence<int, I...>) {
+		(f(std::integral_constant<int, I>{}), ...);
+	}
+
+	/// <summary>
+	/// Calls f(std::integral_constant&lt;int, I&gt;) for I in [0, N) as straight line code
+	/// </summary>
+	template<int N, typename F>
+	inline void unroll(F&& f) {
+		unrollSequence(f, std::make_integer_sequence<int, N>{});
+	}
+}
+
+/// <summary>
+/// Small matrix with compile time dimensions stored inline, for 3x3 to 8x8 sized operands where a heap
+/// buffer and a parallel loop cost more than the arithmetic. Products are fully unrolled and single threaded,
+/// many independent products are spread over the workers by batchMultiply.
+/// </summary>
+template<int R, int C>
+class FixedMatrix {
+	static_assert(R > 0 && C > 0, "FixedMatrix dimensions must be positive");
+	double m[R][C] = {};
+
+public:
+	static constexpr int rows = R;
+	static constexpr int cols = C;
+
+	FixedMatrix() = default;
+
+	/// <summary>
+	/// Copies a Matrix of the same shape, a mismatched Matrix leaves the result zero
+	/// </summary>
+	explicit FixedMatrix(const Matrix& other) {
+		if (other.getRows() != R || other.getCols() != C) {
+			std::printf("Matrix sizes are not matched, conversion not possible.");
+			return;
+		}
+		for (int i = 0; i < R; i++)
+			for (int j = 0; j < C; j++)
+				m[i][j] = other(i, j);
+	}
+
+	static FixedMatrix identity() {
+		FixedMatrix result;
+		for (int i = 0; i < std::min(R, C); i++)
+			result.m[i][i] = 1;
+		return result;
+	}
+
+	/// <summary>
+	/// Uniform values in [-1, 1) for element index * R * C + i * C + j of the stream, so a batch
+	/// filled in parallel is the same for any thread count
+	/// </summary>
+	static FixedMatrix random(uint64_t key, uint64_t index) {
+		FixedMatrix result;
+		rng::fillUniform(&result.m[0][0], R * C, index * R * C, key, -1, 1);
+		return result;
+	}
+
+	constexpr int getRows() const { return R; }
+	constexpr int getCols() const { return C; }
+
+	double& operator()(int i, int j) { return m[i][j]; }
+	const double& operator()(int i, int j) const { return m[i][j]; }
+
+	double* rowPtr(int i) { return m[i]; }
+	const double* rowPtr(int i) const { return m[i]; }
+
+	MatrixView<double> view() { return MatrixView<double>{ &m[0][0], R, C, C }; }
+	MatrixView<const double> view() const { return MatrixView<const double>{ &m[0][0], R, C, C }; }
+
+	Matrix toMatrix() const {
+		Matrix result(0, 0);
+		result.resize(R, C);
+		for (int i = 0; i < R; i++)
+			std::copy(m[i], m[i] + C, result.rowPtr(i));
+		return result;
+	}
+
+	/// <summary>
+	/// Product with every loop unrolled, the columns of a row are independent so they vectorize
+	/// </summary>
+	template<int K>
+	FixedMatrix<R, K> operator*(const FixedMatrix<C, K>& other) const {
+		FixedMatrix<R, K> result;
+		fixed::unroll<R>([&](auto i) {
+			fixed::unroll<C>([&](auto p) {
+				const double a = m[i][p];
+				fixed::unroll<K>([&](auto j) {
+					result(i, j) += a * other(p, j);
+					});
+				});
+			});
+		return result;
+	}
+
+	FixedMatrix operator+(const FixedMatrix& other) const {
+		FixedMatrix result;
+		fixed::unroll<R * C>([&](auto n) {
+			result.m[n / C][n % C] = m[n / C][n % C] + other.m[n / C][n % C];
+			});
+		return result;
+	}
+
+	void print() const {
+		for (int i = 0; i < R; i++) {
+			std::printf("| ");
+			for (int j = 0; j < C; j++) {
+				std::printf(" %f ", m[i][j]);
+			}
+			std::printf(" |\n");
+		}
+		std::printf("\n");
+	}
+};
+
+/// <summary>
+/// out[n] = a[n] * b[n] for every n, tasks take BATCH_CHUNK consecutive products
+/// </summary>
+/// <returns>false if the batches have different lengths, out is then left unchanged</returns>
+template<int R, int K, int C>
+bool batchMultiply(const std::vector<FixedMatrix<R, K>>& a, const std::vector<FixedMatrix<K, C>>& b,
+	std::vector<FixedMatrix<R, C>>& out, ExecutionContext& ctx = Matrix::context()) {
+	constexpr size_t BATCH_CHUNK = 1024;
+	if (a.size() != b.size()) {
+		std::printf("Batch sizes are not matched, multiplication not possible.");
+		return false;
+	}
+	out.resize(a.size());
+	const int chunks = (int)((a.size() + BATCH_CHUNK - 1) / BATCH_CHUNK);
+	ctx.parallelFor(chunks, [&](int c) {
+		const size_t first = (size_t)c * BATCH_CHUNK;
+		const size_t last = std::min(a.size(), first + BATCH_CHUNK);
+		for (size_t n = first; n < last; n++)
+			out[n] = a[n] * b[n];
+		});
+	return true;
+}
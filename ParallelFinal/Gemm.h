@@ -0,0 +1,165 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+#include "MatrixView.h"
+#include "GemmKernels.h"
+
+/// <summary>
+/// Cache blocked matrix multiplication engine shared by the Taskflow and TBB Matrix.
+/// Follows the usual GotoBLAS layering: an NC wide column block of B is sized for L3,
+/// a KC x NC packed panel of B is reused by every row block, an MC x KC packed block of A
+/// stays in L2 and the MR x NR register tile of C is updated from L1 by the micro kernel.
+/// Threading is left to the caller through a parallel for callable.
+/// </summary>
+namespace gemm {
+	constexpr int MC = 96;  //Rows of A packed per L2 block, multiple of MR
+	constexpr int KC = 256; //Depth of the packed A and B panels
+	constexpr int NC = 2048; //Columns of B packed per L3 block, multiple of NR
+	constexpr int NR_TASK = 32; //NR panels of one row block handled by a single task
+
+	/// <summary>
+	/// Operand of a multiplication, a view that is optionally read as its transpose
+	/// </summary>
+	struct Operand {
+		MatrixView<const double> view;
+		bool trans = false;
+
+		int rows() const { return trans ? view.cols : view.rows; }
+		int cols() const { return trans ? view.rows : view.cols; }
+		double operator()(int i, int j) const { return trans ? view(j, i) : view(i, j); }
+		Operand block(int row, int col, int nrows, int ncols) const {
+			if (trans)
+				return Operand{ view.block(col, row, ncols, nrows), true };
+			return Operand{ view.block(row, col, nrows, ncols), false };
+		}
+	};
+
+	/// <summary>
+	/// Packs an mc x kc block of A into MR row slivers, stored column by column, scaled by alpha.
+	/// Rows past the edge of A are zero filled so the micro kernel never branches.
+	/// </summary>
+	inline void packA(Operand a, double alpha, double* buffer) {
+		for (int ir = 0; ir < a.rows(); ir += MR) {
+			const int mr = std::min(MR, a.rows() - ir);
+			for (int p = 0; p < a.cols(); p++) {
+				for (int i = 0; i < mr; i++)
+					buffer[i] = alpha * a(ir + i, p);
+				for (int i = mr; i < MR; i++)
+					buffer[i] = 0;
+				buffer += MR;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Packs a kc x nc block of B into NR column slivers, stored row by row.
+	/// Only the slivers in [firstPanel, lastPanel) are written so packing can be split across tasks.
+	/// </summary>
+	inline void packB(Operand b, double* buffer, int firstPanel, int lastPanel) {
+		for (int panel = firstPanel; panel < lastPanel; panel++) {
+			const int jr = panel * NR;
+			const int nr = std::min(NR, b.cols() - jr);
+			double* out = buffer + (size_t)panel * NR * b.rows();
+			for (int p = 0; p < b.rows(); p++) {
+				if (b.trans) {
+					for (int j = 0; j < nr; j++)
+						out[j] = b.view(jr + j, p);
+				} else {
+					const double* row = b.view.rowPtr(p) + jr;
+					for (int j = 0; j < nr; j++)
+						out[j] = row[j];
+				}
+				for (int j = nr; j < NR; j++)
+					out[j] = 0;
+				out += NR;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Runs the micro kernel over NR panels [firstPanel, lastPanel) of a packed B against a packed A block.
+	/// Edge tiles are computed into a scratch tile and only the valid part is added to C.
+	/// </summary>
+	inline void macroKernel(MicroKernel kernel, const double* packedA, const double* packedB, MatrixView<double> c, int kc,
+		int firstPanel, int lastPanel) {
+		double edge[MR * NR];
+		for (int panel = firstPanel; panel < lastPanel; panel++) {
+			const int jr = panel * NR;
+			const int nr = std::min(NR, c.cols - jr);
+			const double* b = packedB + (size_t)panel * NR * kc;
+			for (int ir = 0; ir < c.rows; ir += MR) {
+				const int mr = std::min(MR, c.rows - ir);
+				const double* a = packedA + (size_t)ir * kc;
+				if (mr == MR && nr == NR) {
+					kernel(kc, a, b, c.rowPtr(ir) + jr, c.stride);
+				} else {
+					std::fill(edge, edge + MR * NR, 0.0);
+					kernel(kc, a, b, edge, NR);
+					for (int i = 0; i < mr; i++)
+						for (int j = 0; j < nr; j++)
+							c(ir + i, jr + j) += edge[i * NR + j];
+				}
+			}
+		}
+	}
+
+	/// <summary>
+	/// Per thread buffer for a packed MC x KC block of A
+	/// </summary>
+	inline double* packedABuffer() {
+		thread_local std::vector<double> buffer((size_t)MC * KC);
+		return buffer.data();
+	}
+
+	/// <summary>
+	/// C = alpha * op(A) * op(B) + beta * C. The caller guarantees a.cols() == b.rows(), c.rows == a.rows() and c.cols == b.cols().
+	/// With beta 0 the old contents of C are never read.
+	/// </summary>
+	/// <param name="parallelFor">Callable taking (int count, F body) that runs body(i) for i in [0, count), possibly in parallel</param>
+	template<typename P>
+	void multiply(Operand a, Operand b, MatrixView<double> c, double alpha, double beta, P&& parallelFor) {
+		const int m = a.rows(), n = b.cols(), k = a.cols();
+		if (beta != 1) {
+			parallelFor(c.rows, [&](int i) {
+				double* row = c.rowPtr(i);
+				if (beta == 0)
+					std::fill(row, row + c.cols, 0.0);
+				else
+					for (int j = 0; j < c.cols; j++)
+						row[j] *= beta;
+				});
+		}
+		if (m == 0 || n == 0 || k == 0 || alpha == 0)
+			return;
+
+		const MicroKernel kernel = activeKernel();
+		std::vector<double> packedB((size_t)KC * std::min(NC, (n + NR - 1) / NR * NR));
+		const int rowBlocks = (m + MC - 1) / MC;
+
+		for (int jc = 0; jc < n; jc += NC) {
+			const int nc = std::min(NC, n - jc);
+			const int panels = (nc + NR - 1) / NR;
+			const int panelGroups = (panels + NR_TASK - 1) / NR_TASK;
+
+			for (int pc = 0; pc < k; pc += KC) {
+				const int kc = std::min(KC, k - pc);
+				Operand bBlock = b.block(pc, jc, kc, nc);
+
+				parallelFor(panelGroups, [&](int group) {
+					packB(bBlock, packedB.data(), group * NR_TASK, std::min(panels, (group + 1) * NR_TASK));
+					});
+
+				//Tasks are (row block, group of NR panels) so small square problems still produce enough work
+				parallelFor(rowBlocks * panelGroups, [&](int task) {
+					const int ic = (task / panelGroups) * MC;
+					const int group = task % panelGroups;
+					const int mc = std::min(MC, m - ic);
+					double* packedA = packedABuffer();
+					packA(a.block(ic, pc, mc, kc), alpha, packedA);
+					macroKernel(kernel, packedA, packedB.data(), c.block(ic, jc, mc, nc), kc,
+						group * NR_TASK, std::min(panels, (group + 1) * NR_TASK));
+					});
+			}
+		}
+	}
+}
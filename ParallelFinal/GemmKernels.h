@@ -0,0 +1,225 @@
+#pragma once
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define GEMM_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+//MSVC lets any function use any intrinsic, GCC and Clang need the instruction set enabled per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define GEMM_TARGET(isa)
+#else
+#define GEMM_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/// <summary>
+/// Register micro kernels for the GEMM engine, one per instruction set, picked at runtime from CPUID.
+/// All kernels share the packed MR x NR tile layout so packing does not depend on the instruction set.
+/// </summary>
+namespace gemm {
+	constexpr int MR = 4;   //Rows of C held in registers by the micro kernel
+	constexpr int NR = 8;   //Columns of C held in registers by the micro kernel
+
+	/// <summary>
+	/// C[MR x NR] += A sliver * B sliver over a depth of kc
+	/// </summary>
+	using MicroKernel = void (*)(int kc, const double* a, const double* b, double* c, int ldc);
+
+	enum class Isa { Scalar, SSE2, AVX2, AVX512 };
+
+	inline const char* isaName(Isa isa) {
+		switch (isa) {
+		case Isa::SSE2: return "SSE2";
+		case Isa::AVX2: return "AVX2+FMA";
+		case Isa::AVX512: return "AVX-512";
+		default: return "Scalar";
+		}
+	}
+
+	inline void microKernelScalar(int kc, const double* a, const double* b, double* c, int ldc) {
+		double acc[MR][NR] = {};
+		for (int p = 0; p < kc; p++) {
+			for (int i = 0; i < MR; i++) {
+				const double ai = a[i];
+				for (int j = 0; j < NR; j++)
+					acc[i][j] += ai * b[j];
+			}
+			a += MR;
+			b += NR;
+		}
+		for (int i = 0; i < MR; i++) {
+			double* row = c + (size_t)i * ldc;
+			for (int j = 0; j < NR; j++)
+				row[j] += acc[i][j];
+		}
+	}
+
+#ifdef GEMM_X86
+	//Only 16 xmm registers, so the tile is done as two MR x 4 halves to keep the accumulators out of memory
+	GEMM_TARGET("sse2")
+	inline void microKernelSSE2(int kc, const double* a, const double* b, double* c, int ldc) {
+		for (int half = 0; half < NR; half += 4) {
+			__m128d acc[MR][2];
+			for (int i = 0; i < MR; i++)
+				acc[i][0] = acc[i][1] = _mm_setzero_pd();
+			const double* ap = a;
+			const double* bp = b + half;
+			for (int p = 0; p < kc; p++) {
+				const __m128d b0 = _mm_loadu_pd(bp);
+				const __m128d b1 = _mm_loadu_pd(bp + 2);
+				for (int i = 0; i < MR; i++) {
+					const __m128d ai = _mm_set1_pd(ap[i]);
+					acc[i][0] = _mm_add_pd(acc[i][0], _mm_mul_pd(ai, b0));
+					acc[i][1] = _mm_add_pd(acc[i][1], _mm_mul_pd(ai, b1));
+				}
+				ap += MR;
+				bp += NR;
+			}
+			for (int i = 0; i < MR; i++) {
+				double* row = c + (size_t)i * ldc + half;
+				_mm_storeu_pd(row, _mm_add_pd(_mm_loadu_pd(row), acc[i][0]));
+				_mm_storeu_pd(row + 2, _mm_add_pd(_mm_loadu_pd(row + 2), acc[i][1]));
+			}
+		}
+	}
+
+	GEMM_TARGET("avx2,fma")
+	inline void microKernelAVX2(int kc, const double* a, const double* b, double* c, int ldc) {
+		__m256d acc[MR][2];
+		for (int i = 0; i < MR; i++)
+			acc[i][0] = acc[i][1] = _mm256_setzero_pd();
+		for (int p = 0; p < kc; p++) {
+			const __m256d b0 = _mm256_loadu_pd(b);
+			const __m256d b1 = _mm256_loadu_pd(b + 4);
+			for (int i = 0; i < MR; i++) {
+				const __m256d ai = _mm256_broadcast_sd(a + i);
+				acc[i][0] = _mm256_fmadd_pd(ai, b0, acc[i][0]);
+				acc[i][1] = _mm256_fmadd_pd(ai, b1, acc[i][1]);
+			}
+			a += MR;
+			b += NR;
+		}
+		for (int i = 0; i < MR; i++) {
+			double* row = c + (size_t)i * ldc;
+			_mm256_storeu_pd(row, _mm256_add_pd(_mm256_loadu_pd(row), acc[i][0]));
+			_mm256_storeu_pd(row + 4, _mm256_add_pd(_mm256_loadu_pd(row + 4), acc[i][1]));
+		}
+	}
+
+	//One zmm covers a whole NR row, so the depth loop is unrolled into two accumulator sets to hide FMA latency
+	GEMM_TARGET("avx512f")
+	inline void microKernelAVX512(int kc, const double* a, const double* b, double* c, int ldc) {
+		__m512d acc0[MR], acc1[MR];
+		for (int i = 0; i < MR; i++)
+			acc0[i] = acc1[i] = _mm512_setzero_pd();
+		int p = 0;
+		for (; p + 1 < kc; p += 2) {
+			const __m512d b0 = _mm512_loadu_pd(b);
+			const __m512d b1 = _mm512_loadu_pd(b + NR);
+			for (int i = 0; i < MR; i++) {
+				acc0[i] = _mm512_fmadd_pd(_mm512_set1_pd(a[i]), b0, acc0[i]);
+				acc1[i] = _mm512_fmadd_pd(_mm512_set1_pd(a[MR + i]), b1, acc1[i]);
+			}
+			a += 2 * MR;
+			b += 2 * NR;
+		}
+		if (p < kc) {
+			const __m512d b0 = _mm512_loadu_pd(b);
+			for (int i = 0; i < MR; i++)
+				acc0[i] = _mm512_fmadd_pd(_mm512_set1_pd(a[i]), b0, acc0[i]);
+		}
+		for (int i = 0; i < MR; i++) {
+			double* row = c + (size_t)i * ldc;
+			_mm512_storeu_pd(row, _mm512_add_pd(_mm512_loadu_pd(row), _mm512_add_pd(acc0[i], acc1[i])));
+		}
+	}
+
+	inline void cpuid(int leaf, int subleaf, unsigned regs[4]) {
+#if defined(_MSC_VER)
+		int r[4];
+		__cpuidex(r, leaf, subleaf);
+		for (int i = 0; i < 4; i++)
+			regs[i] = (unsigned)r[i];
+#else
+		__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	}
+
+	inline unsigned long long xgetbv0() {
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		unsigned eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return ((unsigned long long)edx << 32) | eax;
+#endif
+	}
+#endif
+
+	/// <summary>
+	/// Best instruction set supported by both the CPU and the operating system (saved register state)
+	/// </summary>
+	inline Isa detectIsa() {
+#ifdef GEMM_X86
+		unsigned leaf0[4], leaf1[4], leaf7[4] = {};
+		cpuid(0, 0, leaf0);
+		cpuid(1, 0, leaf1);
+		if (leaf0[0] >= 7)
+			cpuid(7, 0, leaf7);
+
+		const bool osxsave = leaf1[2] & (1u << 27);
+		const unsigned long long xcr0 = osxsave ? xgetbv0() : 0;
+		const bool ymmState = (xcr0 & 0x6) == 0x6;
+		const bool zmmState = (xcr0 & 0xE6) == 0xE6;
+
+		const bool avx = leaf1[2] & (1u << 28);
+		const bool fma = leaf1[2] & (1u << 12);
+		const bool avx2 = leaf7[1] & (1u << 5);
+		const bool avx512f = leaf7[1] & (1u << 16);
+
+		if (avx512f && zmmState)
+			return Isa::AVX512;
+		if (avx && avx2 && fma && ymmState)
+			return Isa::AVX2;
+		if (leaf1[3] & (1u << 26))
+			return Isa::SSE2;
+#endif
+		return Isa::Scalar;
+	}
+
+	inline bool isaSupported(Isa isa) {
+		return (int)isa <= (int)detectIsa();
+	}
+
+	inline MicroKernel kernelFor(Isa isa) {
+#ifdef GEMM_X86
+		switch (isa) {
+		case Isa::AVX512: return microKernelAVX512;
+		case Isa::AVX2: return microKernelAVX2;
+		case Isa::SSE2: return microKernelSSE2;
+		default: break;
+		}
+#endif
+		return microKernelScalar;
+	}
+
+	inline Isa& selectedIsa() {
+		static Isa isa = detectIsa();
+		return isa;
+	}
+
+	/// <summary>
+	/// Forces the micro kernel used by later multiplications, ignored if the CPU does not support it
+	/// </summary>
+	inline void setIsa(Isa isa) {
+		if (isaSupported(isa))
+			selectedIsa() = isa;
+	}
+
+	inline Isa activeIsa() { return selectedIsa(); }
+	inline MicroKernel activeKernel() { return kernelFor(selectedIsa()); }
+}
@@ -1,152 +1,374 @@
 #pragma once
 #include <cmath>
 #include <cstdlib>
-#include <random>
+#include <cstring>
+#include <new>
+#include <cstdint>
 #include <cstdio>
+#include <string>
 #include <taskflow/taskflow.hpp>
+#include "MatrixView.h"
+#include "Gemm.h"
+#include "ExecutionContext.h"
+#include "MatrixAllocator.h"
+#include "Random.h"
+#include "Strassen.h"
+#include "MatrixFile.h"
+
+namespace expr {
+	template<typename E>
+	struct Expr;
+}
 
 /// <summary>
 /// Taskflow parallelized Matrix
 /// </summary>
 class Matrix {
-	double** data = nullptr;
-	int rows;
-	int cols;
+	//Rows start on a cache line boundary, the stride is padded to a whole number of lines
+	static constexpr size_t ALIGNMENT = 64;
+	static constexpr int ALIGN_ELEMS = (int)(ALIGNMENT / sizeof(double));
+
+	double* data = nullptr;
+	int rows = 0;
+	int cols = 0;
+	int stride = 0;
+	MatrixAllocator* source = nullptr; //Allocator data came from, it is returned there
+
+	static int paddedStride(int cols) {
+		return (cols + ALIGN_ELEMS - 1) / ALIGN_ELEMS * ALIGN_ELEMS;
+	}
+
+	void allocData(int rows, int cols) {
+		this->rows = rows;
+		this->cols = cols;
+		this->stride = paddedStride(cols);
+		source = &allocator();
+		data = source->allocate((size_t)rows * stride);
+	}
 
 	void clearData() {
-		if (data && rows > 0) {
-			for (int i = 0; i < rows; i++) {
-				delete[] data[i];
-			}
-			delete[] data;
+		if (data) {
+			source->deallocate(data, (size_t)rows * stride);
 		}
+		data = nullptr;
 	}
 
-	void copy(Matrix& other) {
-		this->rows = other.rows;
-		this->cols = other.cols;
-
-		tf::Taskflow taskflow;
-		tf::Executor tfExec;
+	void copy(const Matrix& other) {
+		resize(other.rows, other.cols);
 
-		taskflow.for_each_index(0, this->rows, 1, [&](int i) {
-			for (int j = 0; j < this->cols; j++) {
-				this->data[i][j] = other.data[i][j];
-			}
+		context().parallelFor2D(this->rows, this->cols, [&](int r0, int r1, int c0, int c1) {
+			for (int i = r0; i < r1; i++)
+				std::memcpy(this->rowPtr(i) + c0, other.rowPtr(i) + c0, sizeof(double) * (c1 - c0));
 			});
-		tfExec.run(taskflow).wait();
+	}
+
+	static ExecutionContext*& contextSlot() {
+		static ExecutionContext* context = &ExecutionContext::global();
+		return context;
+	}
+
+	static MatrixAllocator*& allocatorSlot() {
+		static MatrixAllocator* allocator = &PoolAllocator::global();
+		return allocator;
 	}
 
 public:
 	/// <summary>
-	/// Produces a Matrix. Can initialize with random values, as empty or as an identity matrix
+	/// Produces a Matrix. Can initialize with random values, as empty or as an identity matrix.
+	/// Random values are uniform in [-1, 1), each random Matrix takes the next stream of the global seed (rng::setSeed).
 	/// </summary>
 	/// <param name="rows"></param>
 	/// <param name="cols"></param>
 	/// <param name="rand"></param>
 	Matrix(int rows, int cols, bool rand = false, bool identity = true) {
-		this->rows = rows;
-		this->cols = cols;
-		data = new double* [rows];
-		for (int i = 0; i < rows; i++) {
-			data[i] = new double[cols];
-			if (rand) {
-				std::random_device rd;  //Will be used to obtain a seed for the random number engine
-				std::mt19937 gen(rd()); //Standard mersenne_twister_engine seeded with rd()
-				std::uniform_real_distribution<> distr(-1, 1);
-				for (int j = 0; j < cols; j++)
-					data[i][j] = distr(gen);
-
-			} else {
-				for (int j = 0; j < cols; j++) {
-					if (identity && i == j)
-						data[i][j] = 1;
-					else
-						data[i][j] = 0;
-				}
-			}
+		allocData(rows, cols);
+		if (rand) {
+			randomFill(rng::nextStreamKey());
+			return;
 		}
+		context().parallelFor2D(rows, cols, [&](int r0, int r1, int c0, int c1) {
+			for (int i = r0; i < r1; i++) {
+				double* row = rowPtr(i);
+				std::memset(row + c0, 0, sizeof(double) * (c1 - c0));
+				if (identity && i >= c0 && i < c1)
+					row[i] = 1;
+			}
+			});
 	}
 
-	Matrix(Matrix& other) {
-		this->rows = other.rows;
-		this->cols = other.cols;
-		data = new double* [rows];
-		for (int i = 0; i < rows; i++) {
-			data[i] = new double[cols];
-			for (int j = 0; j < cols; j++)
-				data[i][j] = other.data[i][j];
-		}
+	/// <summary>
+	/// Random Matrix fully determined by the seed, independent of the global seed and of the thread count
+	/// </summary>
+	static Matrix random(int rows, int cols, uint64_t seed) {
+		Matrix result(rows, cols, false, false);
+		result.randomFill(rng::streamKey(seed, 0));
+		return result;
 	}
 
-	Matrix(Matrix&& other) {
+	Matrix(const Matrix& other) {
+		allocData(other.rows, other.cols);
+		if (data)
+			std::memcpy(data, other.data, sizeof(double) * rows * stride);
+	}
+
+	Matrix(Matrix&& other) noexcept {
 		this->rows = other.rows;
 		this->cols = other.cols;
+		this->stride = other.stride;
 		this->data = other.data;
+		this->source = other.source;
 		other.rows = 0;
 		other.cols = 0;
+		other.stride = 0;
 		other.data = nullptr;
 	}
 
+	/// <summary>
+	/// Evaluates a lazy expression, see MatrixExpr.h
+	/// </summary>
+	template<typename E>
+	Matrix(const expr::Expr<E>& e);
+
 	~Matrix() {
 		clearData();
 	}
 
-	Matrix& operator=(Matrix&& other) {
+	Matrix& operator=(Matrix&& other) noexcept {
 		if (&other == this)
 			return *this;
 
 		clearData();
 		this->rows = other.rows;
 		this->cols = other.cols;
+		this->stride = other.stride;
 		this->data = other.data;
+		this->source = other.source;
 
 		other.rows = 0;
 		other.cols = 0;
+		other.stride = 0;
 		other.data = nullptr;
+
+		return *this;
 	}
 
-	Matrix& operator=(Matrix& other) {
+	template<typename E>
+	Matrix& operator=(const expr::Expr<E>& e);
+
+	Matrix& operator=(const Matrix& other) {
 		if (&other == this)
 			return *this;
 
-		clearData();
 		copy(other);
 
 		return *this;
 	}
 
-	Matrix operator*(const Matrix& other) {
-		if (this->cols != other.rows) {
+	/// <summary>
+	/// Execution context shared by all Matrix operations, the process wide one unless replaced
+	/// </summary>
+	static ExecutionContext& context() { return *contextSlot(); }
+
+	/// <summary>
+	/// Routes later Matrix operations to another context. The context must outlive its use.
+	/// </summary>
+	static void setContext(ExecutionContext& context) { contextSlot() = &context; }
+
+	/// <summary>
+	/// Allocator for new Matrix buffers, the process wide size class pool unless replaced
+	/// </summary>
+	static MatrixAllocator& allocator() { return *allocatorSlot(); }
+
+	/// <summary>
+	/// Routes later Matrix allocations to another allocator. Existing matrices still free into their own.
+	/// </summary>
+	static void setAllocator(MatrixAllocator& allocator) { allocatorSlot() = &allocator; }
+
+	int getRows() const { return rows; }
+	int getCols() const { return cols; }
+	/// <summary>
+	/// Leading dimension, the number of doubles between the starts of consecutive rows
+	/// </summary>
+	int getStride() const { return stride; }
+
+	double& operator()(int i, int j) { return data[(size_t)i * stride + j]; }
+	const double& operator()(int i, int j) const { return data[(size_t)i * stride + j]; }
+
+	double* rowPtr(int i) { return data + (size_t)i * stride; }
+	const double* rowPtr(int i) const { return data + (size_t)i * stride; }
+
+	MatrixSlice<double> row(int i) { return MatrixSlice<double>(rowPtr(i), cols, 1); }
+	MatrixSlice<const double> row(int i) const { return MatrixSlice<const double>(rowPtr(i), cols, 1); }
+	MatrixSlice<double> col(int j) { return MatrixSlice<double>(data + j, rows, stride); }
+	MatrixSlice<const double> col(int j) const { return MatrixSlice<const double>(data + j, rows, stride); }
+
+	MatrixView<double> view() { return MatrixView<double>{ data, rows, cols, stride }; }
+	MatrixView<const double> view() const { return MatrixView<const double>{ data, rows, cols, stride }; }
+
+	/// <summary>
+	/// Changes the shape, the buffer is only reallocated when the shape differs. Contents are unspecified afterwards.
+	/// </summary>
+	void resize(int rows, int cols) {
+		if (data && this->rows == rows && this->cols == cols)
+			return;
+		clearData();
+		allocData(rows, cols);
+	}
+
+	/// <summary>
+	/// Fills with uniform values in [lo, hi) in parallel. Element (i, j) depends only on the key and i * cols + j.
+	/// </summary>
+	void randomFill(uint64_t key, double lo = -1, double hi = 1) {
+		context().parallelFor2D(rows, cols, [&](int r0, int r1, int c0, int c1) {
+			for (int i = r0; i < r1; i++)
+				rng::fillUniform(rowPtr(i) + c0, c1 - c0, (uint64_t)i * cols + c0, key, lo, hi);
+			});
+	}
+
+	void setZero() {
+		context().parallelFor2D(rows, cols, [&](int r0, int r1, int c0, int c1) {
+			for (int i = r0; i < r1; i++)
+				std::memset(rowPtr(i) + c0, 0, sizeof(double) * (c1 - c0));
+			});
+	}
+
+	/// <summary>
+	/// c = alpha * op(a) * op(b) + beta * c on views, threaded on the current context with the given
+	/// partitioning policy. The Strassen mode follows the context's own policy.
+	/// </summary>
+	static void multiplyViews(gemm::Operand a, gemm::Operand b, MatrixView<double> c, double alpha, double beta,
+		const partition::Policy& policy) {
+		ExecutionContext& ctx = context();
+		if (alpha == 1 && beta == 0 && !a.trans && !b.trans && strassen::applies(a.rows(), a.cols(), b.cols())) {
+			strassen::multiply(a.view, b.view, c, ctx);
+			return;
+		}
+		gemm::multiply(a, b, c, alpha, beta, [&](int count, auto&& body) {
+			ctx.parallelFor(count, body, policy);
+			});
+	}
+
+	/// <summary>
+	/// c = alpha * op(a) * op(b) + beta * c on views, threaded on the current context. Uses the context's policy
+	/// if one was set, otherwise the policy tuned for this shape (see tune), otherwise the backend default.
+	/// </summary>
+	static void multiplyViews(gemm::Operand a, gemm::Operand b, MatrixView<double> c, double alpha = 1, double beta = 0) {
+		multiplyViews(a, b, c, alpha, beta, policyFor(a.rows(), a.cols(), b.cols()));
+	}
+
+	/// <summary>
+	/// Policy multiplyViews uses for an m x k times k x n product
+	/// </summary>
+	static partition::Policy policyFor(int m, int k, int n) {
+		partition::Policy policy = context().getPolicy();
+		if (policy == partition::Policy{})
+			partition::Tuner::global().lookup(m, k, n, policy);
+		return policy;
+	}
+
+	/// <summary>
+	/// Times every candidate policy on a random m x k times k x n product, keeps the fastest for products
+	/// of that shape bucket and returns all timings so benchmarks can report the choice
+	/// </summary>
+	static partition::TuneResult tune(int m, int k, int n, int repeats = 3) {
+		Matrix a = random(m, k, 1), b = random(k, n, 2), c(0, 0);
+		c.resize(m, n);
+		return partition::Tuner::global().tune(m, k, n, [&](const partition::Policy& policy) {
+			multiplyViews(gemm::Operand{ a.view(), false }, gemm::Operand{ b.view(), false }, c.view(), 1, 0, policy);
+			}, repeats);
+	}
+
+	/// <summary>
+	/// BLAS style dst = alpha * op(a) * op(b) + beta * dst, op transposes its operand when the flag is set.
+	/// With beta 0 dst is resized to the result and its old contents ignored, otherwise it must already have the result's shape.
+	/// dst's buffer is reused, so steady state loops do not allocate unless dst is also one of the operands.
+	/// </summary>
+	/// <returns>false if the shapes do not match, dst is then left unchanged</returns>
+	static bool multiplyInto(Matrix& dst, const Matrix& a, const Matrix& b, double alpha = 1, double beta = 0,
+		bool transA = false, bool transB = false) {
+		gemm::Operand opA{ a.view(), transA };
+		gemm::Operand opB{ b.view(), transB };
+		if (opA.cols() != opB.rows() || (beta != 0 && (dst.rows != opA.rows() || dst.cols != opB.cols()))) {
+			std::printf("Matrix sizes are not matched, multiplication not possible.");
+			return false;
+		}
+
+		if (&dst == &a || &dst == &b) {
+			Matrix result(0, 0);
+			if (beta != 0)
+				result = dst;
+			multiplyInto(result, a, b, alpha, beta, transA, transB);
+			dst = std::move(result);
+			return true;
+		}
+
+		if (beta == 0)
+			dst.resize(opA.rows(), opB.cols());
+		multiplyViews(opA, opB, dst.view(), alpha, beta);
+		return true;
+	}
+
+	/// <summary>
+	/// dst = a * b with an explicit partitioning policy for the product's parallel loops
+	/// </summary>
+	/// <returns>false if the shapes do not match, dst is then left unchanged</returns>
+	static bool multiplyInto(Matrix& dst, const Matrix& a, const Matrix& b, const partition::Policy& policy) {
+		if (a.cols != b.rows) {
 			std::printf("Matrix sizes are not matched, multiplication not possible.");
-			return Matrix(0,0);
-		} else {
-			Matrix result(this->rows, other.cols, false, false);
-			tf::Taskflow taskflow;
-			tf::Executor executor;
-
-			//From taskflow notes
-			tf::Task task = taskflow.for_each_index(0, this->rows, 1, [&](int m) {
-				for (int n = 0; n < other.cols; n++) {
-					for (int k = 0; k < other.rows; k++) {
-						result.data[m][n] += this->data[m][k] * other.data[k][n];
-					}
-				}
-				});
-			executor.run(taskflow).wait();
-
-			return result;
+			return false;
+		}
+		if (&dst == &a || &dst == &b) {
+			Matrix result(0, 0);
+			multiplyInto(result, a, b, policy);
+			dst = std::move(result);
+			return true;
 		}
+		dst.resize(a.rows, b.cols);
+		multiplyViews(gemm::Operand{ a.view(), false }, gemm::Operand{ b.view(), false }, dst.view(), 1, 0, policy);
+		return true;
 	}
 
-	void print() {
+	/// <summary>
+	/// Writes the Matrix in the binary Matrix file format (MatrixFile.h), row blocks are written in parallel
+	/// </summary>
+	/// <returns>false if the file could not be written</returns>
+	bool save(const std::string& path) const {
+		return matrixfile::write(path, view(), context());
+	}
+
+	/// <summary>
+	/// Maps a Matrix file read only without copying it, invalid if the file cannot be used
+	/// </summary>
+	static MappedMatrix map(const std::string& path) {
+		return MappedMatrix::open(path);
+	}
+
+	/// <summary>
+	/// Reads a Matrix file into a new Matrix, 0x0 if the file cannot be used
+	/// </summary>
+	static Matrix load(const std::string& path) {
+		MappedMatrix mapped = map(path);
+		if (!mapped.isValid())
+			return Matrix(0, 0);
+		Matrix result(0, 0);
+		result.resize(mapped.getRows(), mapped.getCols());
+		context().parallelFor2D(result.rows, result.cols, [&](int r0, int r1, int c0, int c1) {
+			for (int i = r0; i < r1; i++)
+				std::memcpy(result.rowPtr(i) + c0, mapped.rowPtr(i) + c0, sizeof(double) * (c1 - c0));
+			});
+		return result;
+	}
+
+	void print() const {
 		for (int i = 0; i < rows; i++) {
 			std::printf("| ");
 			for (int j = 0; j < cols; j++) {
-				std::printf(" %f ", data[i][j]);
+				std::printf(" %f ", (*this)(i, j));
 			}
 			std::printf(" |\n");
 		}
 		std::printf("\n");
 	}
-};
\ No newline at end of file
+};
+
+#include "MatrixExpr.h"
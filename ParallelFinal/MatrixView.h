@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+
+/// <summary>
+/// Non-owning strided view over a single row or column of a Matrix
+/// </summary>
+/// <typeparam name="T">double or const double</typeparam>
+template<typename T>
+class MatrixSlice {
+	T* first;
+	int count;
+	int step;
+public:
+	MatrixSlice(T* first, int count, int step) : first(first), count(count), step(step) {}
+	T& operator[](int i) const { return first[(size_t)i * step]; }
+	int size() const { return count; }
+};
+
+/// <summary>
+/// Non-owning view of a rectangular block of doubles with a leading dimension (row stride)
+/// </summary>
+/// <typeparam name="T">double or const double</typeparam>
+template<typename T>
+struct MatrixView {
+	T* data;
+	int rows;
+	int cols;
+	int stride;
+
+	T& operator()(int i, int j) const { return data[(size_t)i * stride + j]; }
+	T* rowPtr(int i) const { return data + (size_t)i * stride; }
+	MatrixView block(int row, int col, int nrows, int ncols) const {
+		return MatrixView{ rowPtr(row) + col, nrows, ncols, stride };
+	}
+
+	//A writable view can always be read as a const one
+	template<typename U = T, typename = std::enable_if_t<!std::is_const_v<U>>>
+	operator MatrixView<const U>() const { return MatrixView<const U>{ data, rows, cols, stride }; }
+};
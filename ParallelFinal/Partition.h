@@ -0,0 +1,208 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// <summary>
+/// How parallel loops are cut into chunks. ExecutionContext::parallelFor maps a Policy onto the backend's own
+/// partitioners, parallelFor2D splits element-wise loops into rows x columns tiles, and the Tuner times the
+/// candidate policies on a product shape and remembers the fastest for later products of similar shape.
+/// </summary>
+namespace partition {
+	enum class Kind {
+		Auto,     //The backend's default
+		Static,   //Equal chunks assigned up front
+		Dynamic,  //Chunks of exactly grain iterations taken on demand
+		Guided,   //Chunks shrinking towards grain as the loop drains
+		Affinity  //Chunks replayed on the threads that ran them last time, where the backend supports it
+	};
+
+	struct Policy {
+		Kind kind = Kind::Auto;
+		int grain = 0; //Iterations per chunk, 0 lets the backend choose
+
+		bool operator==(const Policy& other) const { return kind == other.kind && grain == other.grain; }
+		bool operator!=(const Policy& other) const { return !(*this == other); }
+	};
+
+	inline const char* name(Kind kind) {
+		switch (kind) {
+		case Kind::Static: return "static";
+		case Kind::Dynamic: return "dynamic";
+		case Kind::Guided: return "guided";
+		case Kind::Affinity: return "affinity";
+		default: return "auto";
+		}
+	}
+
+	/// <summary>
+	/// "kind" or "kind/grain", as printed in benchmark output
+	/// </summary>
+	inline std::string describe(const Policy& policy) {
+		std::string text = name(policy.kind);
+		if (policy.grain > 0)
+			text += "/" + std::to_string(policy.grain);
+		return text;
+	}
+
+	constexpr int TILES_PER_THREAD = 4;       //Spare tiles so threads that finish early can take more
+	constexpr int MIN_TILE_ELEMENTS = 4096;   //32KB of doubles, enough to amortize scheduling a tile
+	constexpr int COL_ALIGN = 8;              //Column splits fall on cache line boundaries
+
+	/// <summary>
+	/// Split of a rows x cols loop into tileRows x tileCols tiles, tiles on the last row or column may be smaller
+	/// </summary>
+	struct Tiling {
+		int rows = 0;
+		int cols = 0;
+		int tileRows = 1;
+		int tileCols = 1;
+
+		int rowTiles() const { return (rows + tileRows - 1) / tileRows; }
+		int colTiles() const { return (cols + tileCols - 1) / tileCols; }
+		int count() const { return rows > 0 && cols > 0 ? rowTiles() * colTiles() : 0; }
+
+		/// <summary>
+		/// Calls body(firstRow, lastRow, firstCol, lastCol) for tile t
+		/// </summary>
+		template<typename F>
+		void apply(int t, F&& body) const {
+			const int r = t / colTiles() * tileRows;
+			const int c = t % colTiles() * tileCols;
+			body(r, std::min(rows, r + tileRows), c, std::min(cols, c + tileCols));
+		}
+	};
+
+	/// <summary>
+	/// Enough tiles of at least MIN_TILE_ELEMENTS to keep every thread busy. Rows are grouped while there are
+	/// more rows than tiles, so tall and skinny loops do not pay one task per short row, and rows are split
+	/// into column ranges when there are fewer, so short and wide loops still use every thread.
+	/// </summary>
+	inline Tiling tiling(int rows, int cols, size_t threads) {
+		Tiling t{ rows, cols, std::max(1, rows), std::max(1, cols) };
+		if (rows <= 0 || cols <= 0)
+			return t;
+		const double elements = (double)rows * cols;
+		const int tiles = (int)std::max(1.0, std::min((double)threads * TILES_PER_THREAD,
+			std::floor(elements / MIN_TILE_ELEMENTS)));
+		if (rows >= tiles) {
+			t.tileRows = (rows + tiles - 1) / tiles;
+		} else {
+			t.tileRows = 1;
+			const int colTiles = (tiles + rows - 1) / rows;
+			t.tileCols = ((cols + colTiles - 1) / colTiles + COL_ALIGN - 1) / COL_ALIGN * COL_ALIGN;
+			t.tileCols = std::min(cols, t.tileCols);
+		}
+		return t;
+	}
+
+	/// <summary>
+	/// Policy tried for a shape and its best time in milliseconds
+	/// </summary>
+	struct Trial {
+		Policy policy;
+		double ms;
+	};
+
+	struct TuneResult {
+		Policy best;
+		std::vector<Trial> trials;
+	};
+
+	/// <summary>
+	/// Table of the fastest policy per product shape. Each dimension is bucketed by floor(log2), the range
+	/// [2^k, 2^(k+1)), so a tuned 1024x1024x1024 product also covers everything up to 2047x2047x2047.
+	/// </summary>
+	class Tuner {
+		std::mutex lock;
+		std::map<uint64_t, Policy> table;
+
+		static uint64_t bucket(int n) {
+			uint64_t b = 0;
+			while (n > 1) {
+				n >>= 1;
+				b++;
+			}
+			return b;
+		}
+
+		static uint64_t key(int m, int k, int n) {
+			return bucket(m) << 42 | bucket(k) << 21 | bucket(n);
+		}
+
+	public:
+		/// <summary>
+		/// Policies tried by tune, the backend default first so it wins ties
+		/// </summary>
+		static std::vector<Policy> candidates() {
+			return {
+				{ Kind::Auto, 0 },
+				{ Kind::Static, 0 },
+				{ Kind::Dynamic, 1 },
+				{ Kind::Dynamic, 4 },
+				{ Kind::Dynamic, 16 },
+				{ Kind::Guided, 1 },
+				{ Kind::Guided, 4 },
+				{ Kind::Affinity, 0 },
+			};
+		}
+
+		/// <summary>
+		/// Times run(policy) for every candidate, keeping the best of repeats runs each, and records the
+		/// fastest for the shape m x k times k x n
+		/// </summary>
+		template<typename F>
+		TuneResult tune(int m, int k, int n, F&& run, int repeats = 3) {
+			TuneResult result;
+			double bestMs = 0;
+			for (const Policy& policy : candidates()) {
+				double ms = 0;
+				for (int r = 0; r < std::max(1, repeats); r++) {
+					const auto start = std::chrono::steady_clock::now();
+					run(policy);
+					const auto end = std::chrono::steady_clock::now();
+					const double elapsed = std::chrono::duration<double, std::milli>(end - start).count();
+					ms = r == 0 ? elapsed : std::min(ms, elapsed);
+				}
+				result.trials.push_back(Trial{ policy, ms });
+				if (result.trials.size() == 1 || ms < bestMs) {
+					bestMs = ms;
+					result.best = policy;
+				}
+			}
+			record(m, k, n, result.best);
+			return result;
+		}
+
+		void record(int m, int k, int n, const Policy& policy) {
+			std::lock_guard<std::mutex> guard(lock);
+			table[key(m, k, n)] = policy;
+		}
+
+		/// <returns>false if no policy was tuned for this shape's bucket</returns>
+		bool lookup(int m, int k, int n, Policy& policy) {
+			std::lock_guard<std::mutex> guard(lock);
+			auto found = table.find(key(m, k, n));
+			if (found == table.end())
+				return false;
+			policy = found->second;
+			return true;
+		}
+
+		void clear() {
+			std::lock_guard<std::mutex> guard(lock);
+			table.clear();
+		}
+
+		static Tuner& global() {
+			static Tuner tuner;
+			return tuner;
+		}
+	};
+}
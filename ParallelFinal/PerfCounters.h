@@ -0,0 +1,237 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#if defined(__linux__)
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "ExecutionContext.h"
+#include "GemmKernels.h"
+
+/// <summary>
+/// Hardware performance counters around a region of code, summed over every thread of the process, and a
+/// roofline model to read them against. On Linux the counters are opened with perf_event_open for each
+/// thread in /proc/self/task when a region starts, so the pool's workers are included, and only user space
+/// is counted, which works at the default perf_event_paranoid level. Elsewhere, or when the kernel refuses
+/// an event, that counter is reported as unavailable and everything else still works.
+/// </summary>
+namespace perf {
+	enum Counter { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, COUNTERS };
+
+	inline const char* name(int counter) {
+		static const char* names[COUNTERS] = { "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses" };
+		return names[counter];
+	}
+
+	struct Sample {
+		uint64_t values[COUNTERS] = {};
+		bool valid[COUNTERS] = {};
+
+		bool any() const { return std::any_of(valid, valid + COUNTERS, [](bool v) { return v; }); }
+
+		/// <summary>
+		/// Instructions per cycle, 0 unless both were counted
+		/// </summary>
+		double ipc() const {
+			return valid[CYCLES] && valid[INSTRUCTIONS] && values[CYCLES] > 0 ? (double)values[INSTRUCTIONS] / values[CYCLES] : 0;
+		}
+
+		/// <summary>
+		/// Bytes brought in from memory estimated as one cache line per last level miss, 0 if not counted
+		/// </summary>
+		double memoryBytes() const { return valid[LLC_MISSES] ? 64.0 * values[LLC_MISSES] : 0; }
+	};
+
+	/// <summary>
+	/// One set of counters per thread of the process, counting from start to stop
+	/// </summary>
+	class CounterSet {
+#if defined(__linux__)
+		std::vector<int> fds[COUNTERS];
+
+		static int openEvent(int counter, pid_t thread) {
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			switch (counter) {
+			case CYCLES:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_CPU_CYCLES;
+				break;
+			case INSTRUCTIONS:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+				break;
+			case L1D_MISSES:
+				attr.type = PERF_TYPE_HW_CACHE;
+				attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+					(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+				break;
+			case LLC_MISSES:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_CACHE_MISSES;
+				break;
+			default:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+				break;
+			}
+			return (int)syscall(SYS_perf_event_open, &attr, thread, -1, -1, 0);
+		}
+
+		static std::vector<pid_t> threads() {
+			std::vector<pid_t> tids;
+			if (DIR* dir = opendir("/proc/self/task")) {
+				while (dirent* entry = readdir(dir)) {
+					if (entry->d_name[0] != '.')
+						tids.push_back((pid_t)std::atoi(entry->d_name));
+				}
+				closedir(dir);
+			}
+			return tids;
+		}
+
+		void close() {
+			for (std::vector<int>& list : fds) {
+				for (int fd : list)
+					::close(fd);
+				list.clear();
+			}
+		}
+#endif
+
+	public:
+		CounterSet() = default;
+		CounterSet(const CounterSet&) = delete;
+		CounterSet& operator=(const CounterSet&) = delete;
+
+#if defined(__linux__)
+		~CounterSet() { close(); }
+
+		/// <summary>
+		/// Opens and enables the counters on every current thread. Threads started later are not counted.
+		/// </summary>
+		void start() {
+			close();
+			for (pid_t tid : threads()) {
+				for (int c = 0; c < COUNTERS; c++) {
+					const int fd = openEvent(c, tid);
+					if (fd >= 0)
+						fds[c].push_back(fd);
+				}
+			}
+			for (const std::vector<int>& list : fds) {
+				for (int fd : list) {
+					ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+					ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+				}
+			}
+		}
+
+		/// <summary>
+		/// Disables the counters and sums them over the threads. A counter is valid if it opened on any thread.
+		/// </summary>
+		Sample stop() {
+			Sample sample;
+			for (const std::vector<int>& list : fds) {
+				for (int fd : list)
+					ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			}
+			for (int c = 0; c < COUNTERS; c++) {
+				for (int fd : fds[c]) {
+					uint64_t value = 0;
+					if (read(fd, &value, sizeof(value)) == (ssize_t)sizeof(value)) {
+						sample.values[c] += value;
+						sample.valid[c] = true;
+					}
+				}
+			}
+			close();
+			return sample;
+		}
+#else
+		void start() {}
+		Sample stop() { return Sample(); }
+#endif
+	};
+
+	/// <summary>
+	/// Counters over one call of body
+	/// </summary>
+	template<typename F>
+	Sample measure(F&& body) {
+		CounterSet counters;
+		counters.start();
+		body();
+		return counters.stop();
+	}
+
+	/// <summary>
+	/// Machine ceilings of the roofline: attainable GFLOP/s for an arithmetic intensity (flops per byte of
+	/// memory traffic) is min(gflops, intensity * bandwidth).
+	/// </summary>
+	struct Roofline {
+		double gflops = 0;      //GEMM micro kernel rate on in cache data over all threads
+		double bandwidth = 0;   //GB/s of a parallel out of cache triad
+
+		double attainable(double intensity) const { return std::min(gflops, intensity * bandwidth); }
+
+		/// <summary>
+		/// "memory" left of the ridge point, where bandwidth limits, "compute" right of it
+		/// </summary>
+		const char* bound(double intensity) const { return intensity * bandwidth < gflops ? "memory" : "compute"; }
+
+		/// <summary>
+		/// Measures both ceilings on ctx with short kernels, best of a few runs each
+		/// </summary>
+		static Roofline measure(ExecutionContext& ctx) {
+			Roofline roof;
+			const int threads = (int)ctx.numThreads();
+
+			//The active GEMM micro kernel on packed slivers that stay in L1, 2 * MR * NR flops per depth step
+			constexpr int DEPTH = 256;
+			constexpr int CALLS = 2000;
+			for (int r = 0; r < 3; r++) {
+				const auto start = std::chrono::steady_clock::now();
+				ctx.parallelFor(threads, [&](int t) {
+					std::vector<double> a(gemm::MR * DEPTH, 1e-3), b(gemm::NR * DEPTH, 1e-3), c(gemm::MR * gemm::NR, t);
+					const gemm::MicroKernel kernel = gemm::activeKernel();
+					for (int k = 0; k < CALLS; k++)
+						kernel(DEPTH, a.data(), b.data(), c.data(), gemm::NR);
+					volatile double sink = c[0];
+					(void)sink;
+					});
+				const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				roof.gflops = std::max(roof.gflops, 2.0 * gemm::MR * gemm::NR * DEPTH * CALLS * threads / seconds * 1e-9);
+			}
+
+			//a = b + s * c over 3 x 32MB, 24 bytes per element, plus the write allocate of a
+			const size_t n = (size_t)1 << 22;
+			std::vector<double> a(n), b(n, 1.0), c(n, 2.0);
+			const int chunks = (int)((n + 65535) / 65536);
+			for (int r = 0; r < 4; r++) {
+				const auto start = std::chrono::steady_clock::now();
+				ctx.parallelFor(chunks, [&](int k) {
+					const size_t first = (size_t)k * 65536, last = std::min(n, first + 65536);
+					for (size_t i = first; i < last; i++)
+						a[i] = b[i] + 3.0 * c[i];
+					});
+				const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				if (r > 0) //The first run faults the pages of a in
+					roof.bandwidth = std::max(roof.bandwidth, 32.0 * n / seconds * 1e-9);
+			}
+			return roof;
+		}
+	};
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <random>
+
+/// <summary>
+/// Counter based random numbers (Philox4x32-10, Salmon et al., SC'11). The value for an element is a pure function
+/// of the key and the element's index, so a parallel fill gives bit identical data for any thread count or schedule.
+/// </summary>
+namespace rng {
+	struct Philox4x32 {
+		uint32_t v[4];
+	};
+
+	inline void mulhilo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo) {
+		const uint64_t product = (uint64_t)a * b;
+		hi = (uint32_t)(product >> 32);
+		lo = (uint32_t)product;
+	}
+
+	/// <summary>
+	/// Ten rounds of Philox on a 128 bit counter with a 64 bit key
+	/// </summary>
+	inline Philox4x32 philox(uint64_t counterLow, uint64_t counterHigh, uint64_t key) {
+		uint32_t c0 = (uint32_t)counterLow, c1 = (uint32_t)(counterLow >> 32);
+		uint32_t c2 = (uint32_t)counterHigh, c3 = (uint32_t)(counterHigh >> 32);
+		uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+		for (int round = 0; round < 10; round++) {
+			uint32_t hi0, lo0, hi1, lo1;
+			mulhilo(0xD2511F53u, c0, hi0, lo0);
+			mulhilo(0xCD9E8D57u, c2, hi1, lo1);
+			const uint32_t n0 = hi1 ^ c1 ^ k0, n2 = hi0 ^ c3 ^ k1;
+			c0 = n0;
+			c1 = lo1;
+			c2 = n2;
+			c3 = lo0;
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+		return Philox4x32{ { c0, c1, c2, c3 } };
+	}
+
+	/// <summary>
+	/// Top 53 bits of a 64 bit value mapped to [lo, hi)
+	/// </summary>
+	inline double toUniform(uint64_t bits, double lo, double hi) {
+		return lo + (hi - lo) * ((bits >> 11) * (1.0 / 9007199254740992.0));
+	}
+
+	/// <summary>
+	/// Splits a seed into independent keys, one per stream (SplitMix64 finalizer)
+	/// </summary>
+	inline uint64_t streamKey(uint64_t seed, uint64_t stream) {
+		uint64_t z = seed + 0x9E3779B97F4A7C15ull * (stream + 1);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	/// <summary>
+	/// Fills out[0, count) with the uniform values for element indices [first, first + count) of a stream.
+	/// Each Philox call yields two doubles, for indices 2c and 2c + 1 of counter c.
+	/// </summary>
+	inline void fillUniform(double* out, int count, uint64_t first, uint64_t key, double lo, double hi) {
+		int j = 0;
+		while (j < count) {
+			const uint64_t index = first + j;
+			const Philox4x32 r = philox(index >> 1, 0, key);
+			const uint64_t even = ((uint64_t)r.v[1] << 32) | r.v[0];
+			const uint64_t odd = ((uint64_t)r.v[3] << 32) | r.v[2];
+			if (index & 1) {
+				out[j++] = toUniform(odd, lo, hi);
+			} else {
+				out[j++] = toUniform(even, lo, hi);
+				if (j < count)
+					out[j++] = toUniform(odd, lo, hi);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Seed shared by everything that draws random data. Random unless set, setSeed makes runs repeatable.
+	/// </summary>
+	inline std::atomic<uint64_t>& globalSeed() {
+		static std::atomic<uint64_t> seed{ ((uint64_t)std::random_device()() << 32) ^ std::random_device()() };
+		return seed;
+	}
+
+	inline std::atomic<uint64_t>& streamCounter() {
+		static std::atomic<uint64_t> counter{ 0 };
+		return counter;
+	}
+
+	/// <summary>
+	/// Sets the global seed and restarts stream numbering, so the same sequence of random matrices is produced again
+	/// </summary>
+	inline void setSeed(uint64_t seed) {
+		globalSeed() = seed;
+		streamCounter() = 0;
+	}
+
+	/// <summary>
+	/// Key of the next stream from the global seed. Streams are numbered in request order.
+	/// </summary>
+	inline uint64_t nextStreamKey() {
+		return streamKey(globalSeed(), streamCounter()++);
+	}
+}
@@ -0,0 +1,367 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <utility>
+#include <vector>
+#include "Matrix.h"
+
+/// <summary>
+/// Entry of a sparse matrix in coordinate (COO) form
+/// </summary>
+struct Triplet {
+	int row;
+	int col;
+	double value;
+};
+
+/// <summary>
+/// Compressed sparse matrix in row (CSR) or column (CSC) order. offsets[k]..offsets[k + 1] are the entries of
+/// row k (CSR) or column k (CSC), indices holds the column (CSR) or row (CSC) of each entry, sorted within a
+/// row or column, and duplicates are summed on construction. Kernels run on Matrix::context() and split their
+/// work into ranges of equal nonzero count rather than equal row count, so a few dense rows do not leave
+/// one task doing most of the work.
+/// </summary>
+class SparseMatrix {
+public:
+	enum class Format { CSR, CSC };
+
+private:
+	int rows = 0;
+	int cols = 0;
+	Format format = Format::CSR;
+	std::vector<size_t> offsets{ 0 };
+	std::vector<int> indices;
+	std::vector<double> values;
+
+	int majorCount() const { return format == Format::CSR ? rows : cols; }
+	int minorCount() const { return format == Format::CSR ? cols : rows; }
+
+	/// <summary>
+	/// Boundaries splitting [0, count) into at most parts ranges of about equal work, where prefix[k] is the
+	/// work of items before k (prefix has count + 1 entries)
+	/// </summary>
+	static std::vector<int> balancedRanges(const std::vector<size_t>& prefix, int parts) {
+		const int count = (int)prefix.size() - 1;
+		parts = std::max(1, std::min(parts, count));
+		std::vector<int> bounds{ 0 };
+		const size_t total = prefix.back();
+		for (int p = 1; p < parts; p++) {
+			const size_t target = total / parts * p + total % parts * p / parts;
+			const int k = (int)(std::lower_bound(prefix.begin(), prefix.end(), target) - prefix.begin());
+			if (k > bounds.back() && k < count)
+				bounds.push_back(k);
+		}
+		bounds.push_back(count);
+		return bounds;
+	}
+
+	static int taskCount() {
+		return (int)Matrix::context().numThreads() * 4;
+	}
+
+	/// <summary>
+	/// Runs body(first, last) over ranges of majors holding about equal numbers of nonzeros
+	/// </summary>
+	template<typename F>
+	static void forBalanced(const std::vector<size_t>& prefix, F&& body) {
+		const std::vector<int> bounds = balancedRanges(prefix, taskCount());
+		Matrix::context().parallelFor((int)bounds.size() - 1, [&](int t) {
+			body(bounds[t], bounds[t + 1]);
+			});
+	}
+
+	/// <summary>
+	/// Builds offsets from per major counts and sizes indices and values to match
+	/// </summary>
+	void allocate(const std::vector<size_t>& counts) {
+		offsets.assign(counts.size() + 1, 0);
+		for (size_t k = 0; k < counts.size(); k++)
+			offsets[k + 1] = offsets[k] + counts[k];
+		indices.resize(offsets.back());
+		values.resize(offsets.back());
+	}
+
+	/// <summary>
+	/// The same matrix stored in the other order, by a counting sort of the entries on their minor index
+	/// </summary>
+	SparseMatrix transposedStorage() const {
+		SparseMatrix result;
+		result.rows = rows;
+		result.cols = cols;
+		result.format = format == Format::CSR ? Format::CSC : Format::CSR;
+		std::vector<size_t> counts(minorCount(), 0);
+		for (int index : indices)
+			counts[index]++;
+		result.allocate(counts);
+		std::vector<size_t> next(result.offsets.begin(), result.offsets.end() - 1);
+		for (int k = 0; k < majorCount(); k++) {
+			for (size_t e = offsets[k]; e < offsets[k + 1]; e++) {
+				const size_t slot = next[indices[e]]++;
+				result.indices[slot] = k;
+				result.values[slot] = values[e];
+			}
+		}
+		return result;
+	}
+
+public:
+	SparseMatrix() = default;
+
+	/// <summary>
+	/// Empty rows x cols matrix
+	/// </summary>
+	SparseMatrix(int rows, int cols, Format format = Format::CSR)
+		: rows(rows), cols(cols), format(format), offsets((format == Format::CSR ? rows : cols) + 1, 0) {}
+
+	/// <summary>
+	/// Builds from COO triplets in any order, entries at the same position are summed.
+	/// Returns a 0x0 matrix if a triplet lies outside rows x cols.
+	/// </summary>
+	static SparseMatrix fromTriplets(int rows, int cols, const std::vector<Triplet>& triplets, Format format = Format::CSR) {
+		SparseMatrix result(rows, cols, format);
+		const bool csr = format == Format::CSR;
+		std::vector<size_t> counts(result.majorCount(), 0);
+		for (const Triplet& t : triplets) {
+			if (t.row < 0 || t.row >= rows || t.col < 0 || t.col >= cols) {
+				std::printf("Triplet index out of range, construction not possible.");
+				return SparseMatrix(0, 0, format);
+			}
+			counts[csr ? t.row : t.col]++;
+		}
+
+		//Scatter by major index, then sort and merge each major's entries in parallel
+		std::vector<size_t> start(counts.size() + 1, 0);
+		for (size_t k = 0; k < counts.size(); k++)
+			start[k + 1] = start[k] + counts[k];
+		std::vector<std::pair<int, double>> entries(triplets.size());
+		std::vector<size_t> next(start.begin(), start.end() - 1);
+		for (const Triplet& t : triplets)
+			entries[next[csr ? t.row : t.col]++] = { csr ? t.col : t.row, t.value };
+
+		std::vector<size_t> unique(counts.size(), 0);
+		forBalanced(start, [&](int first, int last) {
+			for (int k = first; k < last; k++) {
+				auto begin = entries.begin() + start[k], end = entries.begin() + start[k + 1];
+				std::sort(begin, end, [](const auto& x, const auto& y) { return x.first < y.first; });
+				size_t kept = 0;
+				for (auto e = begin; e != end; ++e) {
+					if (kept > 0 && begin[kept - 1].first == e->first)
+						begin[kept - 1].second += e->second;
+					else
+						begin[kept++] = *e;
+				}
+				unique[k] = kept;
+			}
+			});
+
+		result.allocate(unique);
+		forBalanced(result.offsets, [&](int first, int last) {
+			for (int k = first; k < last; k++) {
+				for (size_t e = 0; e < unique[k]; e++) {
+					result.indices[result.offsets[k] + e] = entries[start[k] + e].first;
+					result.values[result.offsets[k] + e] = entries[start[k] + e].second;
+				}
+			}
+			});
+		return result;
+	}
+
+	/// <summary>
+	/// Sparse copy of a dense Matrix keeping entries with |value| > tolerance
+	/// </summary>
+	static SparseMatrix fromDense(const Matrix& dense, Format format = Format::CSR, double tolerance = 0) {
+		SparseMatrix result(dense.getRows(), dense.getCols(), Format::CSR);
+		std::vector<size_t> counts(dense.getRows(), 0);
+		Matrix::context().parallelFor(dense.getRows(), [&](int i) {
+			const double* row = dense.rowPtr(i);
+			for (int j = 0; j < dense.getCols(); j++)
+				counts[i] += std::abs(row[j]) > tolerance;
+			});
+		result.allocate(counts);
+		Matrix::context().parallelFor(dense.getRows(), [&](int i) {
+			const double* row = dense.rowPtr(i);
+			size_t slot = result.offsets[i];
+			for (int j = 0; j < dense.getCols(); j++) {
+				if (std::abs(row[j]) > tolerance) {
+					result.indices[slot] = j;
+					result.values[slot++] = row[j];
+				}
+			}
+			});
+		return format == Format::CSR ? result : result.transposedStorage();
+	}
+
+	Matrix toDense() const {
+		Matrix result(rows, cols, false, false);
+		SparseMatrix converted;
+		if (format == Format::CSC)
+			converted = transposedStorage();
+		const SparseMatrix& csr = format == Format::CSR ? *this : converted;
+		Matrix::context().parallelFor(rows, [&](int i) {
+			double* row = result.rowPtr(i);
+			for (size_t e = csr.offsets[i]; e < csr.offsets[i + 1]; e++)
+				row[csr.indices[e]] = csr.values[e];
+			});
+		return result;
+	}
+
+	SparseMatrix toCSR() const { return format == Format::CSR ? *this : transposedStorage(); }
+	SparseMatrix toCSC() const { return format == Format::CSC ? *this : transposedStorage(); }
+
+	int getRows() const { return rows; }
+	int getCols() const { return cols; }
+	Format getFormat() const { return format; }
+	size_t nonZeros() const { return values.size(); }
+
+	const std::vector<size_t>& getOffsets() const { return offsets; }
+	const std::vector<int>& getIndices() const { return indices; }
+	const std::vector<double>& getValues() const { return values; }
+
+	/// <summary>
+	/// y = A * x. CSR rows are computed independently, CSC columns are scattered into one buffer
+	/// per task and the buffers summed afterwards.
+	/// </summary>
+	/// <returns>false if the vector lengths do not match the matrix</returns>
+	bool multiply(const std::vector<double>& x, std::vector<double>& y) const {
+		if ((int)x.size() != cols) {
+			std::printf("Matrix sizes are not matched, multiplication not possible.");
+			return false;
+		}
+		y.assign(rows, 0.0);
+		if (format == Format::CSR) {
+			forBalanced(offsets, [&](int first, int last) {
+				for (int i = first; i < last; i++) {
+					double sum = 0;
+					for (size_t e = offsets[i]; e < offsets[i + 1]; e++)
+						sum += values[e] * x[indices[e]];
+					y[i] = sum;
+				}
+				});
+			return true;
+		}
+
+		const std::vector<int> bounds = balancedRanges(offsets, taskCount());
+		const int tasks = (int)bounds.size() - 1;
+		std::vector<std::vector<double>> partial(tasks);
+		Matrix::context().parallelFor(tasks, [&](int t) {
+			partial[t].assign(rows, 0.0);
+			for (int j = bounds[t]; j < bounds[t + 1]; j++) {
+				const double xj = x[j];
+				for (size_t e = offsets[j]; e < offsets[j + 1]; e++)
+					partial[t][indices[e]] += values[e] * xj;
+			}
+			});
+		Matrix::context().parallelFor((rows + 4095) / 4096, [&](int block) {
+			for (int i = block * 4096; i < std::min(rows, (block + 1) * 4096); i++) {
+				double sum = 0;
+				for (int t = 0; t < tasks; t++)
+					sum += partial[t][i];
+				y[i] = sum;
+			}
+			});
+		return true;
+	}
+
+	std::vector<double> operator*(const std::vector<double>& x) const {
+		std::vector<double> y;
+		if (!multiply(x, y))
+			return std::vector<double>();
+		return y;
+	}
+
+	/// <summary>
+	/// C = A * B by Gustavson's row by row algorithm. A symbolic pass counts the nonzeros of every row of C,
+	/// a numeric pass fills them using a dense accumulator per task. Rows are split by their multiply count,
+	/// the sum over a row of A of the lengths of the rows of B it selects. Two CSC operands give a CSC result
+	/// computed as C^T = B^T * A^T, any other mix is converted to CSR first.
+	/// </summary>
+	/// <returns>0x0 if the sizes do not match</returns>
+	static SparseMatrix multiply(const SparseMatrix& a, const SparseMatrix& b) {
+		if (a.cols != b.rows) {
+			std::printf("Matrix sizes are not matched, multiplication not possible.");
+			return SparseMatrix(0, 0);
+		}
+		if (a.format == Format::CSC && b.format == Format::CSC) {
+			//The CSC arrays of A and B are the CSR arrays of their transposes
+			SparseMatrix at = a, bt = b;
+			at.format = bt.format = Format::CSR;
+			std::swap(at.rows, at.cols);
+			std::swap(bt.rows, bt.cols);
+			SparseMatrix ct = multiplyCSR(bt, at);
+			ct.format = Format::CSC;
+			std::swap(ct.rows, ct.cols);
+			return ct;
+		}
+		return multiplyCSR(a.toCSR(), b.toCSR());
+	}
+
+	SparseMatrix operator*(const SparseMatrix& other) const {
+		return multiply(*this, other);
+	}
+
+private:
+	static SparseMatrix multiplyCSR(const SparseMatrix& a, const SparseMatrix& b) {
+		SparseMatrix c(a.rows, b.cols);
+		std::vector<size_t> work(a.rows + 1, 0);
+		for (int i = 0; i < a.rows; i++) {
+			size_t w = 0;
+			for (size_t e = a.offsets[i]; e < a.offsets[i + 1]; e++)
+				w += b.offsets[a.indices[e] + 1] - b.offsets[a.indices[e]];
+			work[i + 1] = work[i] + w + 1; //+1 so empty rows still carry some cost
+		}
+		const std::vector<int> bounds = balancedRanges(work, taskCount());
+		const int tasks = (int)bounds.size() - 1;
+
+		//Symbolic: distinct columns per row of C
+		std::vector<size_t> counts(a.rows, 0);
+		Matrix::context().parallelFor(tasks, [&](int t) {
+			std::vector<int> marker(b.cols, -1);
+			for (int i = bounds[t]; i < bounds[t + 1]; i++) {
+				size_t count = 0;
+				for (size_t e = a.offsets[i]; e < a.offsets[i + 1]; e++) {
+					const int k = a.indices[e];
+					for (size_t f = b.offsets[k]; f < b.offsets[k + 1]; f++) {
+						if (marker[b.indices[f]] != i) {
+							marker[b.indices[f]] = i;
+							count++;
+						}
+					}
+				}
+				counts[i] = count;
+			}
+			});
+		c.allocate(counts);
+
+		//Numeric: accumulate each row densely, then emit its columns in order
+		Matrix::context().parallelFor(tasks, [&](int t) {
+			std::vector<double> accumulator(b.cols, 0.0);
+			std::vector<int> marker(b.cols, -1);
+			std::vector<int> touched;
+			for (int i = bounds[t]; i < bounds[t + 1]; i++) {
+				touched.clear();
+				for (size_t e = a.offsets[i]; e < a.offsets[i + 1]; e++) {
+					const int k = a.indices[e];
+					const double aik = a.values[e];
+					for (size_t f = b.offsets[k]; f < b.offsets[k + 1]; f++) {
+						const int j = b.indices[f];
+						if (marker[j] != i) {
+							marker[j] = i;
+							touched.push_back(j);
+							accumulator[j] = 0;
+						}
+						accumulator[j] += aik * b.values[f];
+					}
+				}
+				std::sort(touched.begin(), touched.end());
+				size_t slot = c.offsets[i];
+				for (int j : touched) {
+					c.indices[slot] = j;
+					c.values[slot++] = accumulator[j];
+				}
+			}
+			});
+		return c;
+	}
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <utility>
+#include <vector>
+#include <taskflow/taskflow.hpp>
+#include "ExecutionContext.h"
+
+/// <summary>
+/// Dependency graph of tasks built once and run once, the common surface over the backend's own graph type
+/// so algorithms such as the tiled factorizations (Factorization.h) are written once. Here every task is a
+/// tf::Task of one Taskflow and an edge is tf::Task::precede, a task starts as soon as all its predecessors
+/// have finished.
+/// </summary>
+class TaskGraph {
+	ExecutionContext& ctx;
+	tf::Taskflow taskflow;
+	std::vector<tf::Task> tasks;
+
+public:
+	explicit TaskGraph(ExecutionContext& ctx) : ctx(ctx) {}
+	TaskGraph(const TaskGraph&) = delete;
+	TaskGraph& operator=(const TaskGraph&) = delete;
+
+	/// <summary>
+	/// Adds body as a task, name must be a literal and shows up in traces
+	/// </summary>
+	/// <returns>Index of the task for precede</returns>
+	template<typename F>
+	int add(const char* name, F&& body) {
+		tasks.push_back(taskflow.emplace(std::forward<F>(body)).name(name));
+		return (int)tasks.size() - 1;
+	}
+
+	/// <summary>
+	/// before finishes before after starts
+	/// </summary>
+	void precede(int before, int after) { tasks[before].precede(tasks[after]); }
+
+	int size() const { return (int)tasks.size(); }
+
+	/// <summary>
+	/// Runs every task on the context and waits for the graph to finish
+	/// </summary>
+	void run() { ctx.run(taskflow); }
+};
@@ -0,0 +1,240 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#include "MatrixView.h"
+#include "GemmKernels.h"
+#include "Gemm.h"
+#include "ElementTypes.h"
+
+/// <summary>
+/// Blocked multiplication for element types other than double, following the layering of Gemm.h.
+/// Packing converts the stored type to the compute type of ElementTraits, so half precision operands are
+/// widened to float once per packed panel and the micro kernel only ever sees its own type. The register
+/// tile is MR x (64 bytes of compute type), 4 x 16 for float, and is chosen at compile time.
+/// </summary>
+namespace gemm {
+	template<typename C>
+	struct Tile {
+		static constexpr int MR = 4;
+		static constexpr int NR = (int)(64 / sizeof(C));
+	};
+
+	template<typename C>
+	using TypedKernel = void (*)(int kc, const C* a, const C* b, C* c, int ldc);
+
+	/// <summary>
+	/// Portable kernel, the fixed size loops are vectorized by the compiler for the compute type
+	/// </summary>
+	template<typename C>
+	void microKernelGeneric(int kc, const C* a, const C* b, C* c, int ldc) {
+		constexpr int mr = Tile<C>::MR, nr = Tile<C>::NR;
+		C acc[mr][nr] = {};
+		for (int p = 0; p < kc; p++) {
+			for (int i = 0; i < mr; i++) {
+				const C ai = a[i];
+				for (int j = 0; j < nr; j++)
+					acc[i][j] += ai * b[j];
+			}
+			a += mr;
+			b += nr;
+		}
+		for (int i = 0; i < mr; i++) {
+			C* row = c + (size_t)i * ldc;
+			for (int j = 0; j < nr; j++)
+				row[j] += acc[i][j];
+		}
+	}
+
+#ifdef GEMM_X86
+	GEMM_TARGET("avx2,fma")
+	inline void microKernelFloatAVX2(int kc, const float* a, const float* b, float* c, int ldc) {
+		constexpr int mr = Tile<float>::MR, nr = Tile<float>::NR;
+		__m256 acc[mr][2];
+		for (int i = 0; i < mr; i++)
+			acc[i][0] = acc[i][1] = _mm256_setzero_ps();
+		for (int p = 0; p < kc; p++) {
+			const __m256 b0 = _mm256_loadu_ps(b);
+			const __m256 b1 = _mm256_loadu_ps(b + 8);
+			for (int i = 0; i < mr; i++) {
+				const __m256 ai = _mm256_broadcast_ss(a + i);
+				acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+				acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+			}
+			a += mr;
+			b += nr;
+		}
+		for (int i = 0; i < mr; i++) {
+			float* row = c + (size_t)i * ldc;
+			_mm256_storeu_ps(row, _mm256_add_ps(_mm256_loadu_ps(row), acc[i][0]));
+			_mm256_storeu_ps(row + 8, _mm256_add_ps(_mm256_loadu_ps(row + 8), acc[i][1]));
+		}
+	}
+
+	GEMM_TARGET("avx512f")
+	inline void microKernelFloatAVX512(int kc, const float* a, const float* b, float* c, int ldc) {
+		constexpr int mr = Tile<float>::MR, nr = Tile<float>::NR;
+		__m512 acc0[mr], acc1[mr];
+		for (int i = 0; i < mr; i++)
+			acc0[i] = acc1[i] = _mm512_setzero_ps();
+		int p = 0;
+		for (; p + 1 < kc; p += 2) {
+			const __m512 b0 = _mm512_loadu_ps(b);
+			const __m512 b1 = _mm512_loadu_ps(b + nr);
+			for (int i = 0; i < mr; i++) {
+				acc0[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[i]), b0, acc0[i]);
+				acc1[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[mr + i]), b1, acc1[i]);
+			}
+			a += 2 * mr;
+			b += 2 * nr;
+		}
+		if (p < kc) {
+			const __m512 b0 = _mm512_loadu_ps(b);
+			for (int i = 0; i < mr; i++)
+				acc0[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[i]), b0, acc0[i]);
+		}
+		for (int i = 0; i < mr; i++) {
+			float* row = c + (size_t)i * ldc;
+			_mm512_storeu_ps(row, _mm512_add_ps(_mm512_loadu_ps(row), _mm512_add_ps(acc0[i], acc1[i])));
+		}
+	}
+#endif
+
+	/// <summary>
+	/// Kernel for a compute type. Double uses the kernels of GemmKernels.h, float has its own SIMD kernels
+	/// behind the same runtime instruction set choice, other types use the portable kernel.
+	/// </summary>
+	template<typename C>
+	TypedKernel<C> typedKernel() {
+		if constexpr (std::is_same_v<C, double>) {
+			return activeKernel();
+		} else if constexpr (std::is_same_v<C, float>) {
+#ifdef GEMM_X86
+			switch (activeIsa()) {
+			case Isa::AVX512: return microKernelFloatAVX512;
+			case Isa::AVX2: return microKernelFloatAVX2;
+			default: break;
+			}
+#endif
+			return microKernelGeneric<float>;
+		} else {
+			return microKernelGeneric<C>;
+		}
+	}
+
+	/// <summary>
+	/// Packs an mc x kc block of A into MR row slivers of the compute type, zero padded past the edge
+	/// </summary>
+	template<typename T, typename C>
+	void packATyped(MatrixView<const T> a, C* buffer) {
+		constexpr int mr = Tile<C>::MR;
+		for (int ir = 0; ir < a.rows; ir += mr) {
+			const int rows = std::min(mr, a.rows - ir);
+			for (int p = 0; p < a.cols; p++) {
+				for (int i = 0; i < rows; i++)
+					buffer[i] = ElementTraits<T>::toCompute(a(ir + i, p));
+				for (int i = rows; i < mr; i++)
+					buffer[i] = C();
+				buffer += mr;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Packs NR column slivers [firstPanel, lastPanel) of a kc x nc block of B in the compute type
+	/// </summary>
+	template<typename T, typename C>
+	void packBTyped(MatrixView<const T> b, C* buffer, int firstPanel, int lastPanel) {
+		constexpr int nr = Tile<C>::NR;
+		for (int panel = firstPanel; panel < lastPanel; panel++) {
+			const int jr = panel * nr;
+			const int cols = std::min(nr, b.cols - jr);
+			C* out = buffer + (size_t)panel * nr * b.rows;
+			for (int p = 0; p < b.rows; p++) {
+				const T* row = b.rowPtr(p) + jr;
+				for (int j = 0; j < cols; j++)
+					out[j] = ElementTraits<T>::toCompute(row[j]);
+				for (int j = cols; j < nr; j++)
+					out[j] = C();
+				out += nr;
+			}
+		}
+	}
+
+	template<typename C>
+	void macroKernelTyped(TypedKernel<C> kernel, const C* packedA, const C* packedB, MatrixView<C> c, int kc,
+		int firstPanel, int lastPanel) {
+		constexpr int mr = Tile<C>::MR, nr = Tile<C>::NR;
+		C edge[mr * nr];
+		for (int panel = firstPanel; panel < lastPanel; panel++) {
+			const int jr = panel * nr;
+			const int cols = std::min(nr, c.cols - jr);
+			const C* b = packedB + (size_t)panel * nr * kc;
+			for (int ir = 0; ir < c.rows; ir += mr) {
+				const int rows = std::min(mr, c.rows - ir);
+				const C* a = packedA + (size_t)ir * kc;
+				if (rows == mr && cols == nr) {
+					kernel(kc, a, b, c.rowPtr(ir) + jr, c.stride);
+				} else {
+					std::fill(edge, edge + mr * nr, C());
+					kernel(kc, a, b, edge, nr);
+					for (int i = 0; i < rows; i++)
+						for (int j = 0; j < cols; j++)
+							c(ir + i, jr + j) += edge[i * nr + j];
+				}
+			}
+		}
+	}
+
+	template<typename C>
+	C* packedABufferTyped() {
+		thread_local std::vector<C> buffer((size_t)MC * KC);
+		return buffer.data();
+	}
+
+	/// <summary>
+	/// C = A * B with C in the compute type of the operands' element type. The caller guarantees matching shapes.
+	/// </summary>
+	template<typename T, typename P>
+	void multiplyTyped(MatrixView<const T> a, MatrixView<const T> b, MatrixView<typename ElementTraits<T>::Compute> c,
+		P&& parallelFor) {
+		using C = typename ElementTraits<T>::Compute;
+		constexpr int nr = Tile<C>::NR;
+		const int m = a.rows, n = b.cols, k = a.cols;
+		parallelFor(c.rows, [&](int i) {
+			std::fill(c.rowPtr(i), c.rowPtr(i) + c.cols, C());
+			});
+		if (m == 0 || n == 0 || k == 0)
+			return;
+
+		const TypedKernel<C> kernel = typedKernel<C>();
+		std::vector<C> packedB((size_t)KC * std::min(NC, (n + nr - 1) / nr * nr));
+		const int rowBlocks = (m + MC - 1) / MC;
+
+		for (int jc = 0; jc < n; jc += NC) {
+			const int nc = std::min(NC, n - jc);
+			const int panels = (nc + nr - 1) / nr;
+			const int panelGroups = (panels + NR_TASK - 1) / NR_TASK;
+
+			for (int pc = 0; pc < k; pc += KC) {
+				const int kc = std::min(KC, k - pc);
+				MatrixView<const T> bBlock = b.block(pc, jc, kc, nc);
+
+				parallelFor(panelGroups, [&](int group) {
+					packBTyped(bBlock, packedB.data(), group * NR_TASK, std::min(panels, (group + 1) * NR_TASK));
+					});
+
+				parallelFor(rowBlocks * panelGroups, [&](int task) {
+					const int ic = (task / panelGroups) * MC;
+					const int group = task % panelGroups;
+					const int mc = std::min(MC, m - ic);
+					C* packedA = packedABufferTyped<C>();
+					packATyped(a.block(ic, pc, mc, kc), packedA);
+					macroKernelTyped(kernel, packedA, packedB.data(), c.block(ic, jc, mc, nc), kc,
+						group * NR_TASK, std::min(panels, (group + 1) * NR_TASK));
+					});
+			}
+		}
+	}
+}
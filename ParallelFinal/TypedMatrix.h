@@ -0,0 +1,252 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include "Matrix.h"
+#include "ElementTypes.h"
+#include "TypedGemm.h"
+
+/// <summary>
+/// Matrix with a compile time element type: double, float, int32_t (wrapping), or bf16 / fp16 storage with float arithmetic.
+/// Buffers come from Matrix::allocator() and work runs on Matrix::context(), rows are aligned to cache lines
+/// like Matrix. Products accumulate in ElementTraits&lt;T&gt;::Compute and are rounded to T once when stored.
+/// Matrix remains the double type with expressions, Strassen and files, TypedMatrix&lt;double&gt; exists for
+/// comparisons on equal terms.
+/// </summary>
+template<typename T>
+class TypedMatrix {
+	static_assert(std::is_trivially_copyable_v<T>, "TypedMatrix elements must be trivially copyable");
+	using Traits = ElementTraits<T>;
+	using Compute = typename Traits::Compute;
+
+	static constexpr size_t ALIGNMENT = 64;
+	static constexpr int ALIGN_ELEMS = (int)(ALIGNMENT / sizeof(T));
+
+	T* data = nullptr;
+	int rows = 0;
+	int cols = 0;
+	int stride = 0;
+	MatrixAllocator* source = nullptr;
+
+	static int paddedStride(int cols) {
+		return (cols + ALIGN_ELEMS - 1) / ALIGN_ELEMS * ALIGN_ELEMS;
+	}
+
+	//The allocator hands out doubles, a buffer is rounded up to whole doubles
+	size_t allocatedDoubles() const {
+		return ((size_t)rows * stride * sizeof(T) + sizeof(double) - 1) / sizeof(double);
+	}
+
+	void allocData(int rows, int cols) {
+		this->rows = rows;
+		this->cols = cols;
+		this->stride = paddedStride(cols);
+		source = &Matrix::allocator();
+		data = reinterpret_cast<T*>(source->allocate(allocatedDoubles()));
+	}
+
+	void clearData() {
+		if (data) {
+			source->deallocate(reinterpret_cast<double*>(data), allocatedDoubles());
+		}
+		data = nullptr;
+	}
+
+public:
+	/// <summary>
+	/// Produces a TypedMatrix. Random values are uniform in [-randomScale, randomScale) of ElementTraits,
+	/// drawn from the next stream of the global seed, otherwise the matrix is zero or the identity.
+	/// </summary>
+	TypedMatrix(int rows, int cols, bool rand = false, bool identity = true) {
+		allocData(rows, cols);
+		if (rand) {
+			randomFill(rng::nextStreamKey());
+			return;
+		}
+		Matrix::context().parallelFor(rows, [&](int i) {
+			T* row = rowPtr(i);
+			for (int j = 0; j < this->cols; j++)
+				row[j] = Traits::fromDouble(identity && i == j ? 1 : 0);
+			});
+	}
+
+	/// <summary>
+	/// Converts a double Matrix, rounding every element to T
+	/// </summary>
+	explicit TypedMatrix(const Matrix& other) {
+		allocData(other.getRows(), other.getCols());
+		Matrix::context().parallelFor(rows, [&](int i) {
+			const double* in = other.rowPtr(i);
+			T* out = rowPtr(i);
+			for (int j = 0; j < cols; j++)
+				out[j] = Traits::fromDouble(in[j]);
+			});
+	}
+
+	TypedMatrix(const TypedMatrix& other) {
+		allocData(other.rows, other.cols);
+		if (data)
+			std::memcpy(data, other.data, sizeof(T) * rows * stride);
+	}
+
+	TypedMatrix(TypedMatrix&& other) noexcept {
+		rows = other.rows;
+		cols = other.cols;
+		stride = other.stride;
+		data = other.data;
+		source = other.source;
+		other.rows = 0;
+		other.cols = 0;
+		other.stride = 0;
+		other.data = nullptr;
+	}
+
+	~TypedMatrix() {
+		clearData();
+	}
+
+	TypedMatrix& operator=(TypedMatrix&& other) noexcept {
+		if (&other == this)
+			return *this;
+
+		clearData();
+		rows = other.rows;
+		cols = other.cols;
+		stride = other.stride;
+		data = other.data;
+		source = other.source;
+
+		other.rows = 0;
+		other.cols = 0;
+		other.stride = 0;
+		other.data = nullptr;
+
+		return *this;
+	}
+
+	TypedMatrix& operator=(const TypedMatrix& other) {
+		if (&other == this)
+			return *this;
+
+		resize(other.rows, other.cols);
+		Matrix::context().parallelFor(rows, [&](int i) {
+			std::memcpy(rowPtr(i), other.rowPtr(i), sizeof(T) * cols);
+			});
+
+		return *this;
+	}
+
+	int getRows() const { return rows; }
+	int getCols() const { return cols; }
+	int getStride() const { return stride; }
+
+	T& operator()(int i, int j) { return data[(size_t)i * stride + j]; }
+	const T& operator()(int i, int j) const { return data[(size_t)i * stride + j]; }
+
+	T* rowPtr(int i) { return data + (size_t)i * stride; }
+	const T* rowPtr(int i) const { return data + (size_t)i * stride; }
+
+	MatrixView<T> view() { return MatrixView<T>{ data, rows, cols, stride }; }
+	MatrixView<const T> view() const { return MatrixView<const T>{ data, rows, cols, stride }; }
+
+	/// <summary>
+	/// Changes the shape, the buffer is only reallocated when the shape differs. Contents are unspecified afterwards.
+	/// </summary>
+	void resize(int rows, int cols) {
+		if (data && this->rows == rows && this->cols == cols)
+			return;
+		clearData();
+		allocData(rows, cols);
+	}
+
+	/// <summary>
+	/// Fills with uniform values in [lo, hi) rounded to T, element (i, j) depends only on the key and i * cols + j
+	/// </summary>
+	void randomFill(uint64_t key, double lo = -Traits::randomScale, double hi = Traits::randomScale) {
+		Matrix::context().parallelFor(rows, [&](int i) {
+			thread_local std::vector<double> values;
+			values.resize(cols);
+			rng::fillUniform(values.data(), cols, (uint64_t)i * cols, key, lo, hi);
+			T* row = rowPtr(i);
+			for (int j = 0; j < cols; j++)
+				row[j] = Traits::fromDouble(values[j]);
+			});
+	}
+
+	/// <summary>
+	/// Widens to a double Matrix
+	/// </summary>
+	Matrix toMatrix() const {
+		Matrix result(0, 0);
+		result.resize(rows, cols);
+		Matrix::context().parallelFor(rows, [&](int i) {
+			const T* in = rowPtr(i);
+			double* out = result.rowPtr(i);
+			for (int j = 0; j < cols; j++)
+				out[j] = Traits::toDouble(in[j]);
+			});
+		return result;
+	}
+
+	/// <summary>
+	/// dst = a * b. Types whose compute type differs from T accumulate into a compute type buffer first.
+	/// </summary>
+	/// <returns>false if the shapes do not match, dst is then left unchanged</returns>
+	static bool multiplyInto(TypedMatrix& dst, const TypedMatrix& a, const TypedMatrix& b) {
+		if (a.cols != b.rows) {
+			std::printf("Matrix sizes are not matched, multiplication not possible.");
+			return false;
+		}
+		if (&dst == &a || &dst == &b) {
+			TypedMatrix result(0, 0);
+			multiplyInto(result, a, b);
+			dst = std::move(result);
+			return true;
+		}
+
+		dst.resize(a.rows, b.cols);
+		ExecutionContext& ctx = Matrix::context();
+		auto parallelFor = [&](int count, auto&& body) { ctx.parallelFor(count, body); };
+		if constexpr (std::is_same_v<T, Compute>) {
+			gemm::multiplyTyped(a.view(), b.view(), dst.view(), parallelFor);
+		} else {
+			const int accStride = (dst.cols + 15) / 16 * 16;
+			std::vector<Compute> acc((size_t)dst.rows * accStride);
+			MatrixView<Compute> accView{ acc.data(), dst.rows, dst.cols, accStride };
+			gemm::multiplyTyped(a.view(), b.view(), accView, parallelFor);
+			ctx.parallelFor(dst.rows, [&](int i) {
+				const Compute* in = accView.rowPtr(i);
+				T* out = dst.rowPtr(i);
+				for (int j = 0; j < dst.cols; j++)
+					out[j] = Traits::fromCompute(in[j]);
+				});
+		}
+		return true;
+	}
+
+	TypedMatrix operator*(const TypedMatrix& other) const {
+		TypedMatrix result(0, 0);
+		if (!multiplyInto(result, *this, other))
+			return TypedMatrix(0, 0);
+		return result;
+	}
+
+	void print() const {
+		for (int i = 0; i < rows; i++) {
+			std::printf("| ");
+			for (int j = 0; j < cols; j++) {
+				std::printf(" %f ", Traits::toDouble((*this)(i, j)));
+			}
+			std::printf(" |\n");
+		}
+		std::printf("\n");
+	}
+};
+
+using MatrixF64 = TypedMatrix<double>;
+using MatrixF32 = TypedMatrix<float>;
+using MatrixI32 = TypedMatrix<int32_t>;
+using MatrixBF16 = TypedMatrix<bf16>;
+using MatrixF16 = TypedMatrix<fp16>;
@@ -0,0 +1,543 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "Matrix.h"
+#include "Reduce.h"
+
+/// <summary>
+/// Dense vector of doubles with a 64 byte aligned buffer from the Matrix allocator, for the BLAS level 1 and 2
+/// kernels in namespace blas. Element wise work is split into reduce::CHUNK sized tasks on Matrix::context().
+/// </summary>
+class Vector {
+	double* values = nullptr;
+	int count = 0;
+	MatrixAllocator* source = nullptr; //Allocator values came from, they are returned there
+
+	void allocData(int size) {
+		count = size;
+		source = &Matrix::allocator();
+		values = source->allocate((size_t)size);
+	}
+
+	void clearData() {
+		if (values)
+			source->deallocate(values, (size_t)count);
+		values = nullptr;
+	}
+
+	template<typename F>
+	void forChunks(F&& body) {
+		Matrix::context().parallelFor(reduce::chunkCount((size_t)count), [&](int c) {
+			const size_t first = (size_t)c * reduce::CHUNK;
+			body(first, std::min(reduce::CHUNK, (size_t)count - first));
+			});
+	}
+
+public:
+	/// <summary>
+	/// size elements, all set to value
+	/// </summary>
+	explicit Vector(int size = 0, double value = 0) {
+		allocData(size);
+		fill(value);
+	}
+
+	Vector(const std::vector<double>& elements) {
+		allocData((int)elements.size());
+		if (values)
+			std::memcpy(values, elements.data(), sizeof(double) * count);
+	}
+
+	/// <summary>
+	/// Uniform values in [-1, 1) fully determined by the seed, element i is the one Matrix::random puts at index i
+	/// </summary>
+	static Vector random(int size, uint64_t seed) {
+		Vector result;
+		result.allocData(size);
+		const uint64_t key = rng::streamKey(seed, 0);
+		result.forChunks([&](size_t first, size_t n) {
+			rng::fillUniform(result.values + first, (int)n, first, key, -1, 1);
+			});
+		return result;
+	}
+
+	Vector(const Vector& other) {
+		allocData(other.count);
+		if (values)
+			std::memcpy(values, other.values, sizeof(double) * count);
+	}
+
+	Vector(Vector&& other) noexcept {
+		values = other.values;
+		count = other.count;
+		source = other.source;
+		other.values = nullptr;
+		other.count = 0;
+	}
+
+	~Vector() {
+		clearData();
+	}
+
+	Vector& operator=(const Vector& other) {
+		if (&other == this)
+			return *this;
+		resize(other.count);
+		if (values)
+			std::memcpy(values, other.values, sizeof(double) * count);
+		return *this;
+	}
+
+	Vector& operator=(Vector&& other) noexcept {
+		if (&other == this)
+			return *this;
+		clearData();
+		values = other.values;
+		count = other.count;
+		source = other.source;
+		other.values = nullptr;
+		other.count = 0;
+		return *this;
+	}
+
+	int getSize() const { return count; }
+	double* getData() { return values; }
+	const double* getData() const { return values; }
+
+	double& operator[](int i) { return values[i]; }
+	const double& operator[](int i) const { return values[i]; }
+
+	/// <summary>
+	/// Changes the size, the buffer is only reallocated when the size differs. Contents are unspecified afterwards.
+	/// </summary>
+	void resize(int size) {
+		if (values && count == size)
+			return;
+		clearData();
+		allocData(size);
+	}
+
+	void fill(double value) {
+		forChunks([&](size_t first, size_t n) {
+			std::fill(values + first, values + first + n, value);
+			});
+	}
+
+	void print() const {
+		std::printf("[");
+		for (int i = 0; i < count; i++)
+			std::printf(" %f", values[i]);
+		std::printf(" ]\n\n");
+	}
+};
+
+/// <summary>
+/// BLAS level 1 and 2 kernels. Each takes a parallel for callable like gemm::multiply, so the same code runs on
+/// the Taskflow or TBB context or serially, and the Vector overloads run on Matrix::context(). Work is cut
+/// into pieces of fixed size, never by thread count, so results are bit identical for any number of workers.
+/// The inner loops have AVX2 and FMA versions, used while gemm::activeIsa() allows them, and portable
+/// versions written as independent lanes the compiler can vectorize.
+/// </summary>
+namespace blas {
+	constexpr int GEMV_ELEMENTS = 1 << 15;  //Matrix elements one task streams in a gemv without transpose, 256KB
+	constexpr int GEMVT_ROWS = 512;         //Rows of a transposed gemv summed into one partial result
+	constexpr int GEMVT_COLS = 1024;        //Columns of y per transposed gemv task, 8KB that stays in L1
+
+	namespace kernel {
+		inline double dotPortable(const double* x, const double* y, size_t n) {
+			double acc[reduce::LANES] = {};
+			size_t i = 0;
+			for (; i + reduce::LANES <= n; i += reduce::LANES) {
+				for (int k = 0; k < reduce::LANES; k++)
+					acc[k] += x[i + k] * y[i + k];
+			}
+			for (int k = 0; i < n; i++, k++)
+				acc[k] += x[i] * y[i];
+			return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+		}
+
+		/// <summary>
+		/// out[r] = dot(row r, x) for the 4 rows starting at a, lda apart. x is loaded once for all 4 rows.
+		/// </summary>
+		inline void dot4Portable(const double* a, size_t lda, const double* x, size_t n, double out[4]) {
+			const double* rows[4] = { a, a + lda, a + 2 * lda, a + 3 * lda };
+			double acc[4][4] = {};
+			size_t j = 0;
+			for (; j + 4 <= n; j += 4) {
+				for (int k = 0; k < 4; k++) {
+					const double xk = x[j + k];
+					for (int r = 0; r < 4; r++)
+						acc[r][k] += rows[r][j + k] * xk;
+				}
+			}
+			for (int k = 0; j < n; j++, k++) {
+				for (int r = 0; r < 4; r++)
+					acc[r][k] += rows[r][j] * x[j];
+			}
+			for (int r = 0; r < 4; r++)
+				out[r] = (acc[r][0] + acc[r][1]) + (acc[r][2] + acc[r][3]);
+		}
+
+		inline void axpyPortable(double alpha, const double* x, double* y, size_t n) {
+			for (size_t i = 0; i < n; i++)
+				y[i] += alpha * x[i];
+		}
+
+		/// <summary>
+		/// y += c[0] * row 0 + ... + c[3] * row 3 for the 4 rows starting at a, lda apart. y is loaded and stored once for all 4 rows.
+		/// </summary>
+		inline void axpy4Portable(const double* a, size_t lda, const double* c, double* y, size_t n) {
+			const double* rows[4] = { a, a + lda, a + 2 * lda, a + 3 * lda };
+			for (size_t j = 0; j < n; j++)
+				y[j] += (c[0] * rows[0][j] + c[1] * rows[1][j]) + (c[2] * rows[2][j] + c[3] * rows[3][j]);
+		}
+
+		inline void scalPortable(double alpha, double* x, size_t n) {
+			for (size_t i = 0; i < n; i++)
+				x[i] *= alpha;
+		}
+
+#ifdef GEMM_X86
+		GEMM_TARGET("avx2,fma")
+		inline double horizontalSum(__m256d v) {
+			alignas(32) double lanes[4];
+			_mm256_store_pd(lanes, v);
+			return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+		}
+
+		GEMM_TARGET("avx2,fma")
+		inline double dotAVX2(const double* x, const double* y, size_t n) {
+			__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+			__m256d acc2 = _mm256_setzero_pd(), acc3 = _mm256_setzero_pd();
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16) {
+				acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), acc0);
+				acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4), acc1);
+				acc2 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 8), _mm256_loadu_pd(y + i + 8), acc2);
+				acc3 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 12), _mm256_loadu_pd(y + i + 12), acc3);
+			}
+			for (; i + 4 <= n; i += 4)
+				acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), acc0);
+			double tail = 0;
+			for (; i < n; i++)
+				tail += x[i] * y[i];
+			return horizontalSum(_mm256_add_pd(_mm256_add_pd(acc0, acc1), _mm256_add_pd(acc2, acc3))) + tail;
+		}
+
+		GEMM_TARGET("avx2,fma")
+		inline void dot4AVX2(const double* a, size_t lda, const double* x, size_t n, double out[4]) {
+			const double* rows[4] = { a, a + lda, a + 2 * lda, a + 3 * lda };
+			__m256d acc[4][2];
+			for (int r = 0; r < 4; r++)
+				acc[r][0] = acc[r][1] = _mm256_setzero_pd();
+			size_t j = 0;
+			for (; j + 8 <= n; j += 8) {
+				const __m256d x0 = _mm256_loadu_pd(x + j);
+				const __m256d x1 = _mm256_loadu_pd(x + j + 4);
+				for (int r = 0; r < 4; r++) {
+					acc[r][0] = _mm256_fmadd_pd(_mm256_loadu_pd(rows[r] + j), x0, acc[r][0]);
+					acc[r][1] = _mm256_fmadd_pd(_mm256_loadu_pd(rows[r] + j + 4), x1, acc[r][1]);
+				}
+			}
+			for (int r = 0; r < 4; r++) {
+				double tail = 0;
+				for (size_t k = j; k < n; k++)
+					tail += rows[r][k] * x[k];
+				out[r] = horizontalSum(_mm256_add_pd(acc[r][0], acc[r][1])) + tail;
+			}
+		}
+
+		GEMM_TARGET("avx2,fma")
+		inline void axpyAVX2(double alpha, const double* x, double* y, size_t n) {
+			const __m256d a = _mm256_set1_pd(alpha);
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				_mm256_storeu_pd(y + i, _mm256_fmadd_pd(a, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+				_mm256_storeu_pd(y + i + 4, _mm256_fmadd_pd(a, _mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4)));
+			}
+			for (; i < n; i++)
+				y[i] += alpha * x[i];
+		}
+
+		GEMM_TARGET("avx2,fma")
+		inline void axpy4AVX2(const double* a, size_t lda, const double* c, double* y, size_t n) {
+			const double* rows[4] = { a, a + lda, a + 2 * lda, a + 3 * lda };
+			const __m256d c0 = _mm256_set1_pd(c[0]), c1 = _mm256_set1_pd(c[1]);
+			const __m256d c2 = _mm256_set1_pd(c[2]), c3 = _mm256_set1_pd(c[3]);
+			size_t j = 0;
+			for (; j + 4 <= n; j += 4) {
+				const __m256d left = _mm256_fmadd_pd(c1, _mm256_loadu_pd(rows[1] + j), _mm256_mul_pd(c0, _mm256_loadu_pd(rows[0] + j)));
+				const __m256d right = _mm256_fmadd_pd(c3, _mm256_loadu_pd(rows[3] + j), _mm256_mul_pd(c2, _mm256_loadu_pd(rows[2] + j)));
+				_mm256_storeu_pd(y + j, _mm256_add_pd(_mm256_loadu_pd(y + j), _mm256_add_pd(left, right)));
+			}
+			for (; j < n; j++)
+				y[j] += (c[0] * rows[0][j] + c[1] * rows[1][j]) + (c[2] * rows[2][j] + c[3] * rows[3][j]);
+		}
+
+		GEMM_TARGET("avx2,fma")
+		inline void scalAVX2(double alpha, double* x, size_t n) {
+			const __m256d a = _mm256_set1_pd(alpha);
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				_mm256_storeu_pd(x + i, _mm256_mul_pd(a, _mm256_loadu_pd(x + i)));
+				_mm256_storeu_pd(x + i + 4, _mm256_mul_pd(a, _mm256_loadu_pd(x + i + 4)));
+			}
+			for (; i < n; i++)
+				x[i] *= alpha;
+		}
+#endif
+
+		/// <summary>
+		/// True while the selected GEMM instruction set (gemm::setIsa) includes AVX2 and FMA
+		/// </summary>
+		inline bool avx2() {
+			return (int)gemm::activeIsa() >= (int)gemm::Isa::AVX2;
+		}
+
+		inline double dot(const double* x, const double* y, size_t n) {
+#ifdef GEMM_X86
+			if (avx2())
+				return dotAVX2(x, y, n);
+#endif
+			return dotPortable(x, y, n);
+		}
+
+		inline void dot4(const double* a, size_t lda, const double* x, size_t n, double out[4]) {
+#ifdef GEMM_X86
+			if (avx2())
+				return dot4AVX2(a, lda, x, n, out);
+#endif
+			dot4Portable(a, lda, x, n, out);
+		}
+
+		inline void axpy(double alpha, const double* x, double* y, size_t n) {
+#ifdef GEMM_X86
+			if (avx2())
+				return axpyAVX2(alpha, x, y, n);
+#endif
+			axpyPortable(alpha, x, y, n);
+		}
+
+		inline void axpy4(const double* a, size_t lda, const double* c, double* y, size_t n) {
+#ifdef GEMM_X86
+			if (avx2())
+				return axpy4AVX2(a, lda, c, y, n);
+#endif
+			axpy4Portable(a, lda, c, y, n);
+		}
+
+		inline void scal(double alpha, double* x, size_t n) {
+#ifdef GEMM_X86
+			if (avx2())
+				return scalAVX2(alpha, x, n);
+#endif
+			scalPortable(alpha, x, n);
+		}
+
+		/// <summary>
+		/// dot by pairwise summation down to reduce::LEAF elements, as reduce::pairwiseSum
+		/// </summary>
+		inline double pairwiseDot(const double* x, const double* y, size_t n) {
+			if (n <= reduce::LEAF)
+				return dot(x, y, n);
+			const size_t half = n / 2 / reduce::LANES * reduce::LANES;
+			return pairwiseDot(x, y, half) + pairwiseDot(x + half, y + half, n - half);
+		}
+	}
+
+	/// <summary>
+	/// Runs body(first, count) over [0, n) in reduce::CHUNK pieces
+	/// </summary>
+	template<typename P, typename F>
+	void forChunks(size_t n, P&& parallelFor, F&& body) {
+		parallelFor(reduce::chunkCount(n), [&](int c) {
+			const size_t first = (size_t)c * reduce::CHUNK;
+			body(first, std::min(reduce::CHUNK, n - first));
+			});
+	}
+
+	/// <summary>
+	/// x = alpha * x
+	/// </summary>
+	template<typename P>
+	void scal(double alpha, double* x, size_t n, P&& parallelFor) {
+		forChunks(n, parallelFor, [&](size_t first, size_t count) { kernel::scal(alpha, x + first, count); });
+	}
+
+	/// <summary>
+	/// y = alpha * x + y
+	/// </summary>
+	template<typename P>
+	void axpy(double alpha, const double* x, double* y, size_t n, P&& parallelFor) {
+		forChunks(n, parallelFor, [&](size_t first, size_t count) { kernel::axpy(alpha, x + first, y + first, count); });
+	}
+
+	/// <summary>
+	/// x . y, pairwise within each chunk and across the chunk partials
+	/// </summary>
+	template<typename P>
+	double dot(const double* x, const double* y, size_t n, P&& parallelFor) {
+		std::vector<double> partials(reduce::chunkCount(n));
+		forChunks(n, parallelFor, [&](size_t first, size_t count) {
+			partials[first / reduce::CHUNK] = kernel::pairwiseDot(x + first, y + first, count);
+			});
+		return reduce::combinePairwise(std::move(partials), [](double a, double b) { return a + b; });
+	}
+
+	/// <summary>
+	/// Euclidean norm of x. The sum of squares is taken directly and only redone on x scaled by its largest
+	/// magnitude when it overflowed or fell to where squares lose precision, so usual inputs take one pass.
+	/// </summary>
+	template<typename P>
+	double nrm2(const double* x, size_t n, P&& parallelFor) {
+		const double squares = dot(x, x, n, parallelFor);
+		if (squares >= DBL_MIN / DBL_EPSILON && squares <= DBL_MAX)
+			return std::sqrt(squares);
+
+		std::vector<double> partials(reduce::chunkCount(n));
+		forChunks(n, parallelFor, [&](size_t first, size_t count) {
+			double largest = 0;
+			for (size_t i = first; i < first + count; i++)
+				largest = std::max(largest, std::fabs(x[i]));
+			partials[first / reduce::CHUNK] = largest;
+			});
+		const double scale = partials.empty() ? 0 : *std::max_element(partials.begin(), partials.end());
+		if (scale == 0 || !std::isfinite(scale))
+			return scale;
+		const double inverse = 1 / scale;
+		forChunks(n, parallelFor, [&](size_t first, size_t count) {
+			partials[first / reduce::CHUNK] = reduce::pairwiseSum(x + first, count, [inverse](double v) {
+				return (v * inverse) * (v * inverse);
+				});
+			});
+		return scale * std::sqrt(reduce::combinePairwise(std::move(partials), [](double a, double b) { return a + b; }));
+	}
+
+	/// <summary>
+	/// y = alpha * op(a) * x + beta * y, y has op(a).rows() elements and x op(a).cols(). With beta 0 y is never read.
+	/// Without transpose every task takes whole rows, 4 at a time so each load of x serves 4 rows. Transposed,
+	/// row strips of a are summed 4 rows at a time into partial results per column block, which are then
+	/// added in strip order, so each column block of y is loaded and stored once per 4 rows.
+	/// </summary>
+	template<typename P>
+	void gemv(double alpha, gemm::Operand a, const double* x, double beta, double* y, P&& parallelFor) {
+		const MatrixView<const double> m = a.view;
+		auto finish = [alpha, beta](double sum, double& out) { out = beta == 0 ? alpha * sum : alpha * sum + beta * out; };
+
+		if (!a.trans) {
+			const int blockRows = std::max(4, (GEMV_ELEMENTS / std::max(1, m.cols) + 3) / 4 * 4);
+			parallelFor((m.rows + blockRows - 1) / blockRows, [&](int b) {
+				const int first = b * blockRows, last = std::min(m.rows, first + blockRows);
+				int i = first;
+				for (; i + 4 <= last; i += 4) {
+					double sums[4];
+					kernel::dot4(m.rowPtr(i), m.stride, x, m.cols, sums);
+					for (int r = 0; r < 4; r++)
+						finish(sums[r], y[i + r]);
+				}
+				for (; i < last; i++)
+					finish(kernel::dot(m.rowPtr(i), x, m.cols), y[i]);
+				});
+			return;
+		}
+
+		const int strips = std::max(1, (m.rows + GEMVT_ROWS - 1) / GEMVT_ROWS);
+		const int colBlocks = (m.cols + GEMVT_COLS - 1) / GEMVT_COLS;
+		std::vector<double> partials((size_t)strips * m.cols);
+		parallelFor(strips * colBlocks, [&](int task) {
+			const int strip = task / colBlocks;
+			const int c0 = task % colBlocks * GEMVT_COLS, width = std::min(GEMVT_COLS, m.cols - c0);
+			const int last = std::min(m.rows, (strip + 1) * GEMVT_ROWS);
+			double* out = partials.data() + (size_t)strip * m.cols + c0;
+			std::fill(out, out + width, 0.0);
+			int i = strip * GEMVT_ROWS;
+			for (; i + 4 <= last; i += 4)
+				kernel::axpy4(m.rowPtr(i) + c0, m.stride, x + i, out, width);
+			for (; i < last; i++)
+				kernel::axpy(x[i], m.rowPtr(i) + c0, out, width);
+			});
+		parallelFor(colBlocks, [&](int block) {
+			const int c0 = block * GEMVT_COLS, c1 = std::min(m.cols, c0 + GEMVT_COLS);
+			for (int j = c0; j < c1; j++) {
+				double sum = partials[j];
+				for (int s = 1; s < strips; s++)
+					sum += partials[(size_t)s * m.cols + j];
+				finish(sum, y[j]);
+			}
+			});
+	}
+
+	/// <summary>
+	/// Parallel for on Matrix::context(), used by the Vector overloads
+	/// </summary>
+	inline auto onContext() {
+		return [](int count, auto&& body) { Matrix::context().parallelFor(count, body); };
+	}
+
+	inline void scal(double alpha, Vector& x) {
+		scal(alpha, x.getData(), (size_t)x.getSize(), onContext());
+	}
+
+	/// <returns>false if the sizes do not match, y is then left unchanged</returns>
+	inline bool axpy(double alpha, const Vector& x, Vector& y) {
+		if (x.getSize() != y.getSize()) {
+			std::printf("Vector sizes are not matched, axpy not possible.");
+			return false;
+		}
+		axpy(alpha, x.getData(), y.getData(), (size_t)x.getSize(), onContext());
+		return true;
+	}
+
+	/// <returns>0 if the sizes do not match</returns>
+	inline double dot(const Vector& x, const Vector& y) {
+		if (x.getSize() != y.getSize()) {
+			std::printf("Vector sizes are not matched, dot product not possible.");
+			return 0;
+		}
+		return dot(x.getData(), y.getData(), (size_t)x.getSize(), onContext());
+	}
+
+	inline double nrm2(const Vector& x) {
+		return nrm2(x.getData(), (size_t)x.getSize(), onContext());
+	}
+
+	/// <summary>
+	/// BLAS style y = alpha * op(a) * x + beta * y, op transposes a when trans is set. With beta 0 y is resized
+	/// to the result and its old contents ignored, otherwise it must already have the result's size.
+	/// </summary>
+	/// <returns>false if the sizes do not match, y is then left unchanged</returns>
+	inline bool gemv(double alpha, const Matrix& a, const Vector& x, double beta, Vector& y, bool trans = false) {
+		const gemm::Operand op{ a.view(), trans };
+		if (x.getSize() != op.cols() || (beta != 0 && y.getSize() != op.rows())) {
+			std::printf("Matrix and vector sizes are not matched, gemv not possible.");
+			return false;
+		}
+		if (&x == &y) {
+			Vector result;
+			if (beta != 0)
+				result = y;
+			gemv(alpha, a, x, beta, result, trans);
+			y = std::move(result);
+			return true;
+		}
+		if (beta == 0)
+			y.resize(op.rows());
+		gemv(alpha, op, x.getData(), beta, y.getData(), onContext());
+		return true;
+	}
+}
+
+/// <summary>
+/// a * x as a gemv, an empty Vector if the sizes do not match
+/// </summary>
+inline Vector operator*(const Matrix& a, const Vector& x) {
+	Vector y;
+	if (!blas::gemv(1, a, x, 0, y))
+		return Vector();
+	return y;
+}
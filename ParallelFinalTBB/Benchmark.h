@@ -0,0 +1,502 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Matrix.h"
+#include "PerfCounters.h"
+#include "Reduce.h"
+#include "SparseMatrix.h"
+#include "Stream.h"
+#include "Vector.h"
+
+/// <summary>
+/// Benchmark suite run the same way by both projects. Workloads are generated from the seed with the counter
+/// based generator, so the Taskflow and TBB builds time the same inputs and their CSV or JSON outputs can be
+/// merged. Every workload has a serial variant, the same arithmetic on the calling thread only, and a variant
+/// on this build's backend, swept over sizes and thread counts. Each case is run warmup times untimed, then
+/// repeats times, and reports the median and 95th percentile, GFLOP/s from the median, and the speedup and
+/// efficiency against the serial variant of the same size. Every workload also states the memory traffic its
+/// kernel needs at least, which places each result on a roofline measured on this machine at the same thread
+/// count, and with counters on the timed runs are wrapped in hardware counters summed over all threads.
+/// </summary>
+namespace bench {
+	/// <summary>
+	/// Every workload Suite::run knows, in the order the default run takes them
+	/// </summary>
+	inline const std::vector<std::string>& workloadNames() {
+		static const std::vector<std::string> names{ "gemm", "rms", "spmv", "stream", "gemv", "gemvt", "dot", "axpy" };
+		return names;
+	}
+
+	struct Options {
+		std::vector<std::string> workloads = workloadNames();
+		std::vector<int> gemmSizes{ 256, 512, 1024 };
+		std::vector<int> rmsSizes{ 1 << 20, 1 << 24 };
+		std::vector<int> spmvSizes{ 1 << 14, 1 << 17 };
+		std::vector<int> streamSizes{ 1 << 20, 1 << 24 };
+		std::vector<int> gemvSizes{ 1024, 4096 };
+		std::vector<int> vectorSizes{ 1 << 20, 1 << 24 };
+		std::vector<int> threads; //Empty sweeps 1, 2, 4, ... up to the hardware concurrency
+		int warmup = 1;
+		int repeats = 5;
+		uint64_t seed = 42;
+		bool counters = false;    //Hardware counters around the timed runs, see PerfCounters.h
+	};
+
+	struct Result {
+		std::string workload;
+		std::string variant;  //"serial" or the backend name
+		int size = 0;
+		int threads = 1;
+		int repeats = 0;
+		double medianMs = 0;
+		double p95Ms = 0;
+		double minMs = 0;
+		double gflops = 0;
+		double speedup = 0;   //Serial median over this median
+		double efficiency = 0; //Speedup per thread
+		std::string policy;   //Partitioning policy in effect, see Partition.h
+		double bytes = 0;     //Least memory traffic of one run in the workload's model
+		double bandwidth = 0; //GB/s of that traffic at the median
+		double intensity = 0; //Flops per byte of that traffic
+		double attainable = 0; //GFLOP/s the roofline allows at that intensity
+		const char* bound = "";
+		perf::Sample counters; //Per run, averaged over the timed runs
+	};
+
+	/// <summary>
+	/// Nearest rank percentile of samples, p in [0, 100]
+	/// </summary>
+	inline double percentile(std::vector<double> samples, double p) {
+		if (samples.empty())
+			return 0;
+		std::sort(samples.begin(), samples.end());
+		const size_t rank = (size_t)std::ceil(p / 100 * samples.size());
+		return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+	}
+
+	inline std::vector<int> defaultThreads() {
+		const int hardware = (int)std::max(1u, std::thread::hardware_concurrency());
+		std::vector<int> threads;
+		for (int t = 1; t < hardware; t *= 2)
+			threads.push_back(t);
+		threads.push_back(hardware);
+		return threads;
+	}
+
+	class Suite {
+		Options options;
+		std::vector<Result> results;
+		std::map<int, perf::Roofline> roofs; //Per thread count
+
+		const perf::Roofline& roof(int threads) {
+			auto found = roofs.find(threads);
+			if (found == roofs.end()) {
+				ExecutionContext context((size_t)threads);
+				found = roofs.emplace(threads, perf::Roofline::measure(context)).first;
+			}
+			return found->second;
+		}
+
+		/// <summary>
+		/// Runs body warmup + repeats times and records the timed runs, bytes is the traffic of one run
+		/// </summary>
+		template<typename F>
+		void measure(const std::string& workload, const std::string& variant, int size, int threads, double flops,
+			double bytes, const std::string& policy, F&& body) {
+			for (int w = 0; w < options.warmup; w++)
+				body();
+			std::vector<double> samples;
+			perf::CounterSet counters;
+			if (options.counters)
+				counters.start();
+			for (int r = 0; r < std::max(1, options.repeats); r++) {
+				const auto start = std::chrono::steady_clock::now();
+				body();
+				const auto end = std::chrono::steady_clock::now();
+				samples.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+			}
+			Result result;
+			result.workload = workload;
+			result.variant = variant;
+			result.size = size;
+			result.threads = threads;
+			result.repeats = (int)samples.size();
+			result.medianMs = percentile(samples, 50);
+			result.p95Ms = percentile(samples, 95);
+			result.minMs = percentile(samples, 0);
+			result.gflops = result.medianMs > 0 ? flops / (result.medianMs * 1e6) : 0;
+			result.policy = policy;
+			result.bytes = bytes;
+			result.bandwidth = result.medianMs > 0 ? bytes / (result.medianMs * 1e6) : 0;
+			result.intensity = bytes > 0 ? flops / bytes : 0;
+			if (options.counters) {
+				result.counters = counters.stop();
+				for (uint64_t& value : result.counters.values)
+					value /= samples.size();
+			}
+			const perf::Roofline& machine = roof(threads);
+			result.attainable = machine.attainable(result.intensity);
+			result.bound = machine.bound(result.intensity);
+			//Progress goes to stderr so CSV or JSON on stdout can be piped
+			std::fprintf(stderr, "%-6s %-9s size %9d threads %3d  median %10.3fms  p95 %10.3fms  %8.2f GFLOP/s  %8.2f GB/s\n",
+				workload.c_str(), variant.c_str(), size, threads, result.medianMs, result.p95Ms, result.gflops,
+				result.bandwidth);
+			results.push_back(result);
+		}
+
+		/// <summary>
+		/// Times the backend variant at every thread count, each on its own context
+		/// </summary>
+		template<typename F>
+		void sweep(const std::string& workload, int size, double flops, double bytes, F&& body) {
+			ExecutionContext& previous = Matrix::context();
+			for (int t : options.threads.empty() ? defaultThreads() : options.threads) {
+				ExecutionContext context((size_t)t);
+				context.setTracing(previous.isTracing());
+				Matrix::setContext(context);
+				measure(workload, ExecutionContext::backendName(), size, t, flops, bytes,
+					partition::describe(workload == "gemm" ? Matrix::policyFor(size, size, size) : context.getPolicy()),
+					body);
+				Matrix::setContext(previous);
+			}
+		}
+
+		void gemm(int n) {
+			const double flops = 2.0 * n * n * n;
+			const double bytes = 3.0 * n * n * sizeof(double); //a and b read and c written once
+			Matrix a = Matrix::random(n, n, options.seed), b = Matrix::random(n, n, options.seed + 1), c(0, 0);
+			c.resize(n, n);
+			measure("gemm", "serial", n, 1, flops, bytes, "serial", [&]() {
+				gemm::multiply(gemm::Operand{ a.view(), false }, gemm::Operand{ b.view(), false }, c.view(), 1, 0,
+					[](int count, auto&& body) {
+						for (int i = 0; i < count; i++)
+							body(i);
+					});
+				});
+			sweep("gemm", n, flops, bytes, [&]() { Matrix::multiplyInto(c, a, b); });
+		}
+
+		void rms(int n) {
+			const double flops = 2.0 * n;
+			const double bytes = (double)n * sizeof(double);
+			std::vector<double> x(n);
+			rng::fillUniform(x.data(), n, 0, rng::streamKey(options.seed, 0), -1, 1);
+			volatile double sink = 0;
+			measure("rms", "serial", n, 1, flops, bytes, "serial", [&]() {
+				sink = std::sqrt(reduce::pairwiseSum(x.data(), x.size(), [](double v) { return v * v; }) / n);
+				});
+			sweep("rms", n, flops, bytes, [&]() { sink = reduce::rms(x.data(), x.size(), Matrix::context()); });
+		}
+
+		/// <summary>
+		/// n x n with 16 entries in most rows and every 64th row 32 times denser
+		/// </summary>
+		void spmv(int n) {
+			std::vector<Triplet> triplets;
+			std::vector<double> coords(2);
+			uint64_t index = 0;
+			const uint64_t key = rng::streamKey(options.seed, 1);
+			for (int i = 0; i < n; i++) {
+				for (int e = 0; e < (i % 64 == 0 ? 512 : 16); e++, index++) {
+					rng::fillUniform(coords.data(), 2, index * 2, key, 0, 1);
+					triplets.push_back(Triplet{ i, std::min(n - 1, (int)(coords[0] * n)), coords[1] * 2 - 1 });
+				}
+			}
+			const SparseMatrix a = SparseMatrix::fromTriplets(n, n, triplets);
+			const double flops = 2.0 * a.nonZeros();
+			//Values and column indices once, the row offsets, x and y
+			const double bytes = a.nonZeros() * (sizeof(double) + sizeof(int)) + (n + 1.0) * sizeof(size_t) +
+				2.0 * n * sizeof(double);
+			std::vector<double> x(n), y(n);
+			rng::fillUniform(x.data(), n, 0, rng::streamKey(options.seed, 2), -1, 1);
+			measure("spmv", "serial", n, 1, flops, bytes, "serial", [&]() {
+				const std::vector<size_t>& offsets = a.getOffsets();
+				const std::vector<int>& columns = a.getIndices();
+				const std::vector<double>& values = a.getValues();
+				for (int i = 0; i < n; i++) {
+					double sum = 0;
+					for (size_t e = offsets[i]; e < offsets[i + 1]; e++)
+						sum += values[e] * x[columns[e]];
+					y[i] = sum;
+				}
+				});
+			sweep("spmv", n, flops, bytes, [&]() { a.multiply(x, y); });
+		}
+
+		/// <summary>
+		/// Moments and sum of squares of a file of n doubles through the read, process and collect pipeline, in
+		/// at least 16 blocks so the stages overlap. The file stays in the page cache between runs.
+		/// </summary>
+		void streamStats(int n) {
+			const std::string path = "bench_stream.bin";
+			std::vector<double> x(n);
+			rng::fillUniform(x.data(), n, 0, rng::streamKey(options.seed, 3), -1, 1);
+			std::FILE* file = std::fopen(path.c_str(), "wb");
+			const bool written = file && std::fwrite(x.data(), sizeof(double), x.size(), file) == x.size();
+			if (!file || std::fclose(file) != 0 || !written) {
+				std::fprintf(stderr, "Could not write %s, stream skipped.\n", path.c_str());
+				return;
+			}
+			const size_t block = std::min(stream::BLOCK, std::max<size_t>(4096, n / 16));
+			const double flops = 4.0 * n; //Moments update and the square sum
+			const double bytes = (double)n * sizeof(double);
+			volatile double sink = 0;
+			measure("stream", "serial", n, 1, flops, bytes, "serial", [&]() {
+				BlockReader reader(path, block);
+				std::vector<double> buffer(block);
+				reduce::Moments moments;
+				double sumSquares = 0;
+				for (size_t b = 0; b < reader.blocks(); b++) {
+					const size_t count = reader.read(b, buffer.data());
+					moments = reduce::Moments::merge(moments, reduce::blockMoments(buffer.data(), count));
+					sumSquares += reduce::pairwiseSum(buffer.data(), count, [](double v) { return v * v; });
+				}
+				sink = moments.mean + sumSquares;
+				});
+			sweep("stream", n, flops, bytes, [&]() {
+				stream::Stats stats;
+				stream::statistics(path, stats, block, stream::LINES, Matrix::context());
+				sink = stats.rms();
+				});
+			std::remove(path.c_str());
+		}
+
+		/// <summary>
+		/// y = a * x for an n x n a, or a transposed times x, bandwidth bound as a is read once
+		/// </summary>
+		void gemv(int n, bool trans) {
+			const char* workload = trans ? "gemvt" : "gemv";
+			const double flops = 2.0 * n * n;
+			const double bytes = (n * (double)n + 2.0 * n) * sizeof(double);
+			const Matrix a = Matrix::random(n, n, options.seed);
+			const Vector x = Vector::random(n, options.seed + 1);
+			Vector y(n);
+			measure(workload, "serial", n, 1, flops, bytes, "serial", [&]() {
+				blas::gemv(1, gemm::Operand{ a.view(), trans }, x.getData(), 0, y.getData(), [](int count, auto&& body) {
+					for (int i = 0; i < count; i++)
+						body(i);
+					});
+				});
+			sweep(workload, n, flops, bytes, [&]() { blas::gemv(1, a, x, 0, y, trans); });
+		}
+
+		void dot(int n) {
+			const double flops = 2.0 * n;
+			const double bytes = 2.0 * n * sizeof(double);
+			const Vector x = Vector::random(n, options.seed), y = Vector::random(n, options.seed + 1);
+			volatile double sink = 0;
+			measure("dot", "serial", n, 1, flops, bytes, "serial", [&]() {
+				sink = blas::dot(x.getData(), y.getData(), (size_t)n, [](int count, auto&& body) {
+					for (int i = 0; i < count; i++)
+						body(i);
+					});
+				});
+			sweep("dot", n, flops, bytes, [&]() { sink = blas::dot(x, y); });
+		}
+
+		/// <summary>
+		/// y += alpha * x with alpha alternating sign so y stays bounded over the runs
+		/// </summary>
+		void axpy(int n) {
+			const double flops = 2.0 * n;
+			const double bytes = 3.0 * n * sizeof(double); //x and y read, y written
+			const Vector x = Vector::random(n, options.seed);
+			Vector y = Vector::random(n, options.seed + 1);
+			double alpha = 0.5;
+			measure("axpy", "serial", n, 1, flops, bytes, "serial", [&]() {
+				alpha = -alpha;
+				blas::axpy(alpha, x.getData(), y.getData(), (size_t)n, [](int count, auto&& body) {
+					for (int i = 0; i < count; i++)
+						body(i);
+					});
+				});
+			sweep("axpy", n, flops, bytes, [&]() {
+				alpha = -alpha;
+				blas::axpy(alpha, x, y);
+				});
+		}
+
+		/// <summary>
+		/// Fills in speedup and efficiency from the serial result of the same workload and size
+		/// </summary>
+		void compare() {
+			for (Result& r : results) {
+				for (const Result& s : results) {
+					if (s.variant == "serial" && s.workload == r.workload && s.size == r.size && r.medianMs > 0) {
+						r.speedup = s.medianMs / r.medianMs;
+						r.efficiency = r.speedup / r.threads;
+					}
+				}
+			}
+		}
+
+	public:
+		explicit Suite(const Options& options) : options(options) {}
+
+		const std::vector<Result>& getResults() const { return results; }
+
+		/// <summary>
+		/// Runs every selected workload over its sizes, unknown workload names are reported and skipped
+		/// </summary>
+		void run() {
+			for (const std::string& workload : options.workloads) {
+				if (workload == "gemm") {
+					for (int n : options.gemmSizes)
+						gemm(n);
+				} else if (workload == "rms") {
+					for (int n : options.rmsSizes)
+						rms(n);
+				} else if (workload == "spmv") {
+					for (int n : options.spmvSizes)
+						spmv(n);
+				} else if (workload == "stream") {
+					for (int n : options.streamSizes)
+						streamStats(n);
+				} else if (workload == "gemv" || workload == "gemvt") {
+					for (int n : options.gemvSizes)
+						gemv(n, workload == "gemvt");
+				} else if (workload == "dot") {
+					for (int n : options.vectorSizes)
+						dot(n);
+				} else if (workload == "axpy") {
+					for (int n : options.vectorSizes)
+						axpy(n);
+				} else {
+					std::fprintf(stderr, "Unknown workload %s, skipped.\n", workload.c_str());
+				}
+			}
+			compare();
+		}
+
+		void print() const {
+			std::printf("\n%-6s %-9s %9s %7s %12s %12s %10s %8s %10s  %s\n", "work", "variant", "size", "threads",
+				"median ms", "p95 ms", "GFLOP/s", "speedup", "efficiency", "policy");
+			for (const Result& r : results) {
+				std::printf("%-6s %-9s %9d %7d %12.3f %12.3f %10.2f %8.2f %10.2f  %s\n", r.workload.c_str(),
+					r.variant.c_str(), r.size, r.threads, r.medianMs, r.p95Ms, r.gflops, r.speedup, r.efficiency,
+					r.policy.c_str());
+			}
+			std::printf("\nRoofline, ceilings measured at each thread count:\n%7s %12s %10s %12s\n", "threads", "peak GFLOP/s",
+				"peak GB/s", "ridge flop/B");
+			for (const auto& entry : roofs) {
+				const perf::Roofline& r = entry.second;
+				std::printf("%7d %12.2f %10.2f %12.2f\n", entry.first, r.gflops, r.bandwidth,
+					r.bandwidth > 0 ? r.gflops / r.bandwidth : 0);
+			}
+			std::printf("\n%-6s %-9s %9s %7s %10s %8s %11s %8s  %s\n", "work", "variant", "size", "threads", "GB/s", "flop/B",
+				"attainable", "of roof", "bound");
+			for (const Result& r : results) {
+				std::printf("%-6s %-9s %9d %7d %10.2f %8.3f %11.2f %7.1f%%  %s\n", r.workload.c_str(), r.variant.c_str(),
+					r.size, r.threads, r.bandwidth, r.intensity, r.attainable,
+					r.attainable > 0 ? 100 * r.gflops / r.attainable : 0, r.bound);
+			}
+			if (options.counters) {
+				std::printf("\nCounters per run, summed over threads:\n%-6s %-9s %9s %7s", "work", "variant", "size", "threads");
+				for (int c = 0; c < perf::COUNTERS; c++)
+					std::printf(" %14s", perf::name(c));
+				std::printf(" %6s %9s\n", "IPC", "LLC GB/s");
+				for (const Result& r : results) {
+					std::printf("%-6s %-9s %9d %7d", r.workload.c_str(), r.variant.c_str(), r.size, r.threads);
+					for (int c = 0; c < perf::COUNTERS; c++) {
+						if (r.counters.valid[c])
+							std::printf(" %14llu", (unsigned long long)r.counters.values[c]);
+						else
+							std::printf(" %14s", "n/a");
+					}
+					std::printf(" %6.2f %9.2f\n", r.counters.ipc(),
+						r.medianMs > 0 ? r.counters.memoryBytes() / (r.medianMs * 1e6) : 0);
+				}
+				bool any = false;
+				for (const Result& r : results)
+					any = any || r.counters.any();
+				if (!any)
+					std::printf("No counter could be opened, check /proc/sys/kernel/perf_event_paranoid.\n");
+			}
+			std::printf("\n");
+		}
+
+		/// <summary>
+		/// One header line, then one line per result
+		/// </summary>
+		void writeCSV(std::FILE* file) const {
+			std::fprintf(file, "backend,workload,variant,size,threads,repeats,seed,median_ms,p95_ms,min_ms,gflops,speedup,efficiency,policy,"
+				"bytes,gbs,intensity,attainable_gflops,bound");
+			for (int c = 0; c < perf::COUNTERS; c++)
+				std::fprintf(file, ",%s", perf::name(c));
+			std::fprintf(file, "\n");
+			for (const Result& r : results) {
+				std::fprintf(file, "%s,%s,%s,%d,%d,%d,%llu,%.6f,%.6f,%.6f,%.4f,%.4f,%.4f,%s,%.0f,%.4f,%.6f,%.4f,%s",
+					ExecutionContext::backendName(), r.workload.c_str(), r.variant.c_str(), r.size, r.threads, r.repeats,
+					(unsigned long long)options.seed, r.medianMs, r.p95Ms, r.minMs, r.gflops, r.speedup, r.efficiency,
+					r.policy.c_str(), r.bytes, r.bandwidth, r.intensity, r.attainable, r.bound);
+				//Counters that were not measured are left empty
+				for (int c = 0; c < perf::COUNTERS; c++) {
+					if (r.counters.valid[c])
+						std::fprintf(file, ",%llu", (unsigned long long)r.counters.values[c]);
+					else
+						std::fprintf(file, ",");
+				}
+				std::fprintf(file, "\n");
+			}
+		}
+
+		void writeJSON(std::FILE* file) const {
+			std::fprintf(file, "{\n  \"backend\": \"%s\",\n  \"seed\": %llu,\n  \"warmup\": %d,\n  \"hardware_threads\": %u,\n  \"roofline\": [",
+				ExecutionContext::backendName(), (unsigned long long)options.seed, options.warmup,
+				std::thread::hardware_concurrency());
+			bool first = true;
+			for (const auto& entry : roofs) {
+				std::fprintf(file, "%s\n    {\"threads\": %d, \"peak_gflops\": %.4f, \"peak_gbs\": %.4f}", first ? "" : ",",
+					entry.first, entry.second.gflops, entry.second.bandwidth);
+				first = false;
+			}
+			std::fprintf(file, "\n  ],\n  \"results\": [");
+			for (size_t n = 0; n < results.size(); n++) {
+				const Result& r = results[n];
+				std::fprintf(file, "%s\n    {\"workload\": \"%s\", \"variant\": \"%s\", \"size\": %d, \"threads\": %d, "
+					"\"repeats\": %d, \"median_ms\": %.6f, \"p95_ms\": %.6f, \"min_ms\": %.6f, \"gflops\": %.4f, "
+					"\"speedup\": %.4f, \"efficiency\": %.4f, \"policy\": \"%s\", \"bytes\": %.0f, \"gbs\": %.4f, "
+					"\"intensity\": %.6f, \"attainable_gflops\": %.4f, \"bound\": \"%s\"",
+					n ? "," : "", r.workload.c_str(), r.variant.c_str(), r.size, r.threads, r.repeats, r.medianMs,
+					r.p95Ms, r.minMs, r.gflops, r.speedup, r.efficiency, r.policy.c_str(), r.bytes, r.bandwidth,
+					r.intensity, r.attainable, r.bound);
+				if (options.counters) {
+					std::fprintf(file, ", \"counters\": {");
+					for (int c = 0; c < perf::COUNTERS; c++) {
+						if (r.counters.valid[c])
+							std::fprintf(file, "%s\"%s\": %llu", c ? ", " : "", perf::name(c), (unsigned long long)r.counters.values[c]);
+						else
+							std::fprintf(file, "%s\"%s\": null", c ? ", " : "", perf::name(c));
+					}
+					std::fprintf(file, "}");
+				}
+				std::fprintf(file, "}");
+			}
+			std::fprintf(file, "\n  ]\n}\n");
+		}
+
+		/// <summary>
+		/// Writes the results as "csv" or "json" to path
+		/// </summary>
+		/// <returns>false if the file could not be written</returns>
+		bool write(const std::string& path, const std::string& format) const {
+			std::FILE* file = std::fopen(path.c_str(), "w");
+			if (!file) {
+				std::printf("Could not open %s for writing.\n", path.c_str());
+				return false;
+			}
+			if (format == "json")
+				writeJSON(file);
+			else
+				writeCSV(file);
+			return std::fclose(file) == 0;
+		}
+	};
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// <summary>
+/// Reads a raw file of doubles in fixed size blocks by offset (pread, or ReadFile with an offset on Windows),
+/// so blocks can be fetched in any order without a shared file position. The file is opened for sequential
+/// access and on Linux the block after each read is announced to the kernel so it is read ahead.
+/// </summary>
+class BlockReader {
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+#else
+	int file = -1;
+#endif
+	uint64_t bytes = 0;
+	size_t blockElements;
+	bool error = false;
+
+	size_t readAt(uint64_t offset, char* out, size_t length) {
+		size_t done = 0;
+		while (done < length) {
+#if defined(_WIN32)
+			OVERLAPPED position = {};
+			position.Offset = (DWORD)(offset + done);
+			position.OffsetHigh = (DWORD)((offset + done) >> 32);
+			const DWORD request = (DWORD)std::min<size_t>(length - done, (size_t)1 << 30);
+			DWORD got = 0;
+			if (!ReadFile(file, out + done, request, &got, &position) || got == 0)
+				break;
+#else
+			const ssize_t got = pread(file, out + done, length - done, (off_t)(offset + done));
+			if (got <= 0)
+				break;
+#endif
+			done += (size_t)got;
+		}
+		if (done < length)
+			error = true;
+		return done;
+	}
+
+public:
+	/// <param name="blockElements">Number of doubles in a block, the last block may be shorter</param>
+	BlockReader(const std::string& path, size_t blockElements) : blockElements(blockElements) {
+#if defined(_WIN32)
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER size;
+		if (file != INVALID_HANDLE_VALUE && GetFileSizeEx(file, &size))
+			bytes = (uint64_t)size.QuadPart;
+#else
+		file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		struct stat info;
+		if (file >= 0 && fstat(file, &info) == 0)
+			bytes = (uint64_t)info.st_size;
+#if defined(POSIX_FADV_SEQUENTIAL)
+		if (file >= 0)
+			posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#endif
+		//Trailing bytes that are not a whole double would otherwise be dropped without notice
+		if (bytes % sizeof(double) != 0)
+			error = true;
+	}
+
+	BlockReader(const BlockReader&) = delete;
+	BlockReader& operator=(const BlockReader&) = delete;
+
+	~BlockReader() {
+#if defined(_WIN32)
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (file >= 0)
+			close(file);
+#endif
+	}
+
+	bool isOpen() const {
+#if defined(_WIN32)
+		return file != INVALID_HANDLE_VALUE;
+#else
+		return file >= 0;
+#endif
+	}
+
+	/// <summary>
+	/// True when a read came back short, the file changed size or could not be read, or its size is not a
+	/// whole number of doubles. Reads return 0 once this is set.
+	/// </summary>
+	bool failed() const { return error; }
+
+	uint64_t elements() const { return bytes / sizeof(double); }
+	size_t blockSize() const { return blockElements; }
+	size_t blocks() const { return (size_t)((elements() + blockElements - 1) / blockElements); }
+
+	/// <summary>
+	/// Reads block number block into out, which holds blockSize() doubles.
+	/// Returns the number of doubles read, 0 past the end of the file or on error.
+	/// </summary>
+	size_t read(size_t block, double* out) {
+		const uint64_t first = (uint64_t)block * blockElements;
+		if (!isOpen() || error || first >= elements())
+			return 0;
+		const size_t count = (size_t)std::min<uint64_t>(blockElements, elements() - first);
+		const uint64_t offset = first * sizeof(double);
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+		posix_fadvise(file, (off_t)(offset + count * sizeof(double)), (off_t)(blockElements * sizeof(double)), POSIX_FADV_WILLNEED);
+#endif
+		return readAt(offset, reinterpret_cast<char*>(out), count * sizeof(double)) / sizeof(double);
+	}
+};
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdio>
+#include <utility>
+#include <vector>
+#include <tbb/tbb.h>
+#include "Matrix.h"
+
+/// <summary>
+/// Product of a chain of matrices by a balanced tree reduction. Neighbouring pairs are multiplied concurrently,
+/// then pairs of their results and so on, so the depth is log2(n) products instead of n - 1. The tree is a
+/// tbb::parallel_deterministic_reduce with a simple partitioner, which always splits the chain down to pairs
+/// at the midpoint whatever the thread count, so the parenthesization and the rounding are the same on every
+/// run. Joins always take the right neighbour, so the order of the factors is kept.
+/// </summary>
+namespace chain {
+	inline bool checkSizes(const std::vector<Matrix>& factors) {
+		for (size_t n = 1; n < factors.size(); n++) {
+			if (factors[n - 1].getCols() != factors[n].getRows()) {
+				std::printf("Matrix sizes are not matched, multiplication not possible.");
+				return false;
+			}
+		}
+		return true;
+	}
+
+	class ChainBody {
+		const std::vector<Matrix>& factors;
+		bool empty = true; //No factor taken yet, the identity of the reduction
+
+		void append(const Matrix& right) {
+			if (empty) {
+				result = right;
+				empty = false;
+			} else {
+				Matrix product(0, 0);
+				Matrix::multiplyInto(product, result, right);
+				result = std::move(product);
+			}
+		}
+
+	public:
+		Matrix result{ 0, 0 };
+
+		explicit ChainBody(const std::vector<Matrix>& factors) : factors(factors) {}
+		ChainBody(ChainBody& other, tbb::split) : factors(other.factors) {}
+
+		void operator()(const tbb::blocked_range<size_t>& r) {
+			for (size_t n = r.begin(); n != r.end(); n++)
+				append(factors[n]);
+		}
+
+		void join(ChainBody& right) {
+			if (right.empty)
+				return;
+			if (empty) {
+				result = std::move(right.result);
+				empty = false;
+			} else {
+				append(right.result);
+			}
+		}
+	};
+}
+
+/// <summary>
+/// factors[0] * factors[1] * ... * factors[n - 1], 0x0 for an empty chain or mismatched sizes
+/// </summary>
+inline Matrix chainProduct(const std::vector<Matrix>& factors) {
+	if (factors.empty() || !chain::checkSizes(factors))
+		return Matrix(0, 0);
+	if (factors.size() == 1)
+		return factors[0];
+
+	chain::ChainBody body(factors);
+	Matrix::context().execute([&]() {
+		tbb::parallel_deterministic_reduce(tbb::blocked_range<size_t>(0, factors.size(), 2), body, tbb::simple_partitioner());
+		});
+	return std::move(body.result);
+}
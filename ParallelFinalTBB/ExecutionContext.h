@@ -0,0 +1,230 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <tbb/tbb.h>
+#include "Partition.h"
+#include "Trace.h"
+
+/// <summary>
+/// Body used for a parallel for
+/// </summary>
+/// <typeparam name="A">Callable, applied each iteration</typeparam>
+template<typename A>
+class TBBMatrixBody {
+	A action;
+public:
+	TBBMatrixBody(A func) : action(func) {}
+	void operator()(const tbb::blocked_range<int>& r) const {
+		for (auto i = r.begin(); i != r.end(); i++) {
+			action(i);
+		}
+	}
+};
+
+/// <summary>
+/// Records the time every thread spends inside the arena. Chunk spans inside an arena span are work,
+/// the gaps between them are time spent looking for work to steal.
+/// </summary>
+class ArenaTraceObserver : public tbb::task_scheduler_observer {
+	static int64_t& entered() {
+		thread_local int64_t time = -1;
+		return time;
+	}
+
+public:
+	explicit ArenaTraceObserver(tbb::task_arena& arena) : tbb::task_scheduler_observer(arena) {
+		observe(true);
+	}
+
+	~ArenaTraceObserver() {
+		observe(false);
+	}
+
+	void on_scheduler_entry(bool worker) override {
+		thread_local bool named = false;
+		if (!named && worker) {
+			trace::Recorder::global().nameThread("tbb worker " + std::to_string(tbb::this_task_arena::current_thread_index()));
+			named = true;
+		}
+		entered() = trace::Recorder::global().now();
+	}
+
+	void on_scheduler_exit(bool) override {
+		if (entered() >= 0 && trace::enabled())
+			trace::Recorder::global().record("in arena", "arena", entered(), trace::Recorder::global().now());
+		entered() = -1;
+	}
+};
+
+/// <summary>
+/// Owns the tbb::task_arena used by Matrix operations so the thread count is explicit and the arena is reused.
+/// A process wide instance is used by default, a different one can be injected with Matrix::setContext.
+/// </summary>
+class ExecutionContext {
+	std::unique_ptr<tbb::task_arena> arena;
+	partition::Policy policy;
+	tbb::affinity_partitioner affinity; //Replays the chunk to thread mapping of the previous Affinity loop
+	std::atomic<bool> affinityBusy{ false }; //affinity is used by one loop at a time, others fall back to auto
+	std::unique_ptr<ArenaTraceObserver> observer; //Declared after arena, so it is destroyed first
+
+public:
+	/// <param name="workers">Number of threads in the arena, 0 uses the hardware concurrency</param>
+	explicit ExecutionContext(size_t workers = 0) {
+		setThreads(workers);
+	}
+
+	ExecutionContext(const ExecutionContext&) = delete;
+	ExecutionContext& operator=(const ExecutionContext&) = delete;
+
+	/// <summary>
+	/// Replaces the arena with one of the given size. Must not be called while work is running in it.
+	/// </summary>
+	void setThreads(size_t workers) {
+		if (workers == 0)
+			workers = std::max(1u, std::thread::hardware_concurrency());
+		const bool tracing = isTracing();
+		observer.reset();
+		arena = std::make_unique<tbb::task_arena>((int)workers);
+		arena->initialize();
+		setTracing(tracing);
+	}
+
+	/// <summary>
+	/// Attaches or removes the observer that records the arena's threads, see Trace.h. Events are only
+	/// stored between trace::Recorder::start and stop.
+	/// </summary>
+	void setTracing(bool on) {
+		if (on && !observer)
+			observer = std::make_unique<ArenaTraceObserver>(*arena);
+		else if (!on)
+			observer.reset();
+	}
+
+	bool isTracing() const { return observer != nullptr; }
+
+	size_t numThreads() const { return (size_t)arena->max_concurrency(); }
+
+	tbb::task_arena& getArena() { return *arena; }
+
+	/// <summary>
+	/// Runs f inside the arena, a thread already in the arena runs it directly
+	/// </summary>
+	template<typename F>
+	void execute(F&& f) {
+		arena->execute(f);
+	}
+
+	/// <summary>
+	/// Policy used by parallelFor when none is passed. Like setThreads, must not change while work is running.
+	/// </summary>
+	void setPolicy(const partition::Policy& policy) { this->policy = policy; }
+	const partition::Policy& getPolicy() const { return policy; }
+
+	/// <summary>
+	/// Sets the context's policy for the lifetime of the scope and restores the previous one afterwards
+	/// </summary>
+	class PolicyScope {
+		ExecutionContext& context;
+		partition::Policy previous;
+	public:
+		PolicyScope(ExecutionContext& context, const partition::Policy& policy) : context(context), previous(context.policy) {
+			context.policy = policy;
+		}
+		~PolicyScope() { context.policy = previous; }
+		PolicyScope(const PolicyScope&) = delete;
+		PolicyScope& operator=(const PolicyScope&) = delete;
+	};
+
+	/// <summary>
+	/// Calls body(i) for i in [0, count) in parallel, chunked by the context's policy
+	/// </summary>
+	template<typename F>
+	void parallelFor(int count, F&& body) {
+		parallelFor(count, body, policy);
+	}
+
+	/// <summary>
+	/// Calls body(i) for i in [0, count) in parallel, chunked by the given policy. While tracing, every index
+	/// is recorded as a chunk of this loop and the caller records a span over the whole loop.
+	/// </summary>
+	template<typename F>
+	void parallelFor(int count, F&& body, const partition::Policy& with) {
+		if (!trace::enabled()) {
+			partitionedFor(count, body, with);
+			return;
+		}
+		trace::Recorder& recorder = trace::Recorder::global();
+		const int64_t loop = recorder.nextLoop();
+		const int64_t begin = recorder.now();
+		partitionedFor(count, [&](int i) {
+			const int64_t start = recorder.now();
+			body(i);
+			recorder.record("chunk", "chunk", start, recorder.now(), loop);
+			}, with);
+		recorder.record("parallelFor", "loop", begin, recorder.now(), loop);
+	}
+
+	/// <summary>
+	/// parallelFor without tracing. The grain is the blocked_range grain size. Dynamic uses the simple
+	/// partitioner, which splits down to the grain, Guided the auto partitioner, which adapts chunk sizes
+	/// to stealing. Affinity loops nested in or concurrent with another Affinity loop use the auto
+	/// partitioner, the affinity state is not shareable.
+	/// </summary>
+	template<typename F>
+	void partitionedFor(int count, F&& body, const partition::Policy& with) {
+		if (count <= 0)
+			return;
+		if (count == 1) {
+			body(0);
+			return;
+		}
+		TBBMatrixBody<std::decay_t<F>> forBody(body);
+		const tbb::blocked_range<int> range(0, count, (size_t)std::max(1, with.grain));
+		switch (with.kind) {
+		case partition::Kind::Static:
+			execute([&]() { tbb::parallel_for(range, forBody, tbb::static_partitioner()); });
+			break;
+		case partition::Kind::Dynamic:
+			execute([&]() { tbb::parallel_for(range, forBody, tbb::simple_partitioner()); });
+			break;
+		case partition::Kind::Affinity: {
+			if (!affinityBusy.exchange(true)) {
+				//Cleared on the way out even when the body throws, or every later loop would fall back to auto
+				struct Release {
+					std::atomic<bool>& flag;
+					~Release() { flag = false; }
+				} release{ affinityBusy };
+				execute([&]() { tbb::parallel_for(range, forBody, affinity); });
+				break;
+			}
+			execute([&]() { tbb::parallel_for(range, forBody, tbb::auto_partitioner()); });
+			break;
+		}
+		default:
+			execute([&]() { tbb::parallel_for(range, forBody, tbb::auto_partitioner()); });
+			break;
+		}
+	}
+
+	/// <summary>
+	/// Calls body(firstRow, lastRow, firstCol, lastCol) over tiles covering a rows x cols loop, see partition::tiling
+	/// </summary>
+	template<typename F>
+	void parallelFor2D(int rows, int cols, F&& body) {
+		const partition::Tiling tiles = partition::tiling(rows, cols, numThreads());
+		parallelFor(tiles.count(), [&](int t) { tiles.apply(t, body); });
+	}
+
+	/// <summary>
+	/// Name of the backend in benchmark output
+	/// </summary>
+	static const char* backendName() { return "tbb"; }
+
+	static ExecutionContext& global() {
+		static ExecutionContext context;
+		return context;
+	}
+};
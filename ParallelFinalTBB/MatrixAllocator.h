@@ -0,0 +1,202 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+#include "ExecutionContext.h"
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+/// <summary>
+/// Counters describing allocation pressure, a snapshot taken by MatrixAllocator::stats
+/// </summary>
+struct AllocatorStats {
+	size_t hits = 0;       //Requests served from a free list
+	size_t misses = 0;     //Requests that went to the system allocator
+	size_t bytesHeld = 0;  //Bytes sitting in free lists, ready for reuse
+	size_t bytesInUse = 0; //Bytes handed out and not yet returned
+};
+
+/// <summary>
+/// Source of Matrix buffers. Matrix::setAllocator switches the allocator used for new buffers,
+/// each Matrix returns its buffer to the allocator it came from.
+/// </summary>
+class MatrixAllocator {
+public:
+	virtual ~MatrixAllocator() = default;
+	virtual double* allocate(size_t count) = 0;
+	virtual void deallocate(double* data, size_t count) = 0;
+	virtual AllocatorStats stats() const { return AllocatorStats(); }
+};
+
+/// <summary>
+/// Plain 64 byte aligned new and delete, every request is a miss
+/// </summary>
+class NewAllocator : public MatrixAllocator {
+	static constexpr size_t ALIGNMENT = 64;
+	std::atomic<size_t> misses{ 0 };
+	std::atomic<size_t> inUse{ 0 };
+public:
+	double* allocate(size_t count) override {
+		if (count == 0)
+			return nullptr;
+		misses++;
+		inUse += count * sizeof(double);
+		return static_cast<double*>(::operator new[](count * sizeof(double), std::align_val_t(ALIGNMENT)));
+	}
+
+	void deallocate(double* data, size_t count) override {
+		if (!data)
+			return;
+		inUse -= count * sizeof(double);
+		::operator delete[](data, std::align_val_t(ALIGNMENT));
+	}
+
+	AllocatorStats stats() const override {
+		AllocatorStats s;
+		s.misses = misses;
+		s.bytesInUse = inUse;
+		return s;
+	}
+
+	static NewAllocator& global() {
+		static NewAllocator allocator;
+		return allocator;
+	}
+};
+
+/// <summary>
+/// Thread safe pool that keeps freed buffers in size classes for reuse. Classes are spaced a quarter of a power
+/// of two apart, so a buffer is at most 25% larger than requested. Buffers are 64 byte aligned, buffers of 2MB
+/// and more are aligned to 2MB and advised for transparent huge pages on Linux. Fresh buffers are first touched
+/// in parallel on the execution context so their pages are spread over the NUMA nodes of the workers that use them.
+/// </summary>
+class PoolAllocator : public MatrixAllocator {
+	static constexpr size_t ALIGNMENT = 64;
+	static constexpr size_t HUGE_PAGE = 2 * 1024 * 1024;
+	static constexpr size_t MIN_CLASS = 256;
+	static constexpr size_t TOUCH_CHUNK = 64 * 1024;
+
+	std::mutex lock;
+	std::unordered_map<size_t, std::vector<void*>> freeLists;
+	size_t maxHeld;
+	ExecutionContext* context;
+
+	std::atomic<size_t> hits{ 0 };
+	std::atomic<size_t> misses{ 0 };
+	std::atomic<size_t> held{ 0 };
+	std::atomic<size_t> inUse{ 0 };
+
+	static size_t classSize(size_t bytes) {
+		if (bytes <= MIN_CLASS)
+			return MIN_CLASS;
+		size_t power = MIN_CLASS;
+		while (power * 2 <= bytes)
+			power *= 2;
+		const size_t step = power / 4;
+		return (bytes + step - 1) / step * step;
+	}
+
+	static size_t alignmentFor(size_t bytes) {
+		return bytes >= HUGE_PAGE ? HUGE_PAGE : ALIGNMENT;
+	}
+
+	void* allocateFresh(size_t bytes) {
+		void* block = ::operator new(bytes, std::align_val_t(alignmentFor(bytes)));
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+		if (bytes >= HUGE_PAGE)
+			madvise(block, bytes, MADV_HUGEPAGE);
+#endif
+		char* first = static_cast<char*>(block);
+		const int chunks = (int)((bytes + TOUCH_CHUNK - 1) / TOUCH_CHUNK);
+		context->parallelFor(chunks, [&](int i) {
+			const size_t offset = (size_t)i * TOUCH_CHUNK;
+			std::memset(first + offset, 0, std::min(TOUCH_CHUNK, bytes - offset));
+			});
+		return block;
+	}
+
+	static void release(void* block, size_t bytes) {
+		::operator delete(block, std::align_val_t(alignmentFor(bytes)));
+	}
+
+public:
+	/// <param name="maxHeld">Upper bound on bytes kept in free lists, buffers returned past it are released</param>
+	/// <param name="context">Context used for the parallel first touch of fresh buffers</param>
+	explicit PoolAllocator(size_t maxHeld = (size_t)1 << 30, ExecutionContext& context = ExecutionContext::global())
+		: maxHeld(maxHeld), context(&context) {}
+
+	PoolAllocator(const PoolAllocator&) = delete;
+	PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+	~PoolAllocator() override {
+		trim();
+	}
+
+	double* allocate(size_t count) override {
+		if (count == 0)
+			return nullptr;
+		const size_t bytes = classSize(count * sizeof(double));
+		inUse += bytes;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			auto found = freeLists.find(bytes);
+			if (found != freeLists.end() && !found->second.empty()) {
+				void* block = found->second.back();
+				found->second.pop_back();
+				held -= bytes;
+				hits++;
+				return static_cast<double*>(block);
+			}
+		}
+		misses++;
+		return static_cast<double*>(allocateFresh(bytes));
+	}
+
+	void deallocate(double* data, size_t count) override {
+		if (!data)
+			return;
+		const size_t bytes = classSize(count * sizeof(double));
+		inUse -= bytes;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (held + bytes <= maxHeld) {
+				freeLists[bytes].push_back(data);
+				held += bytes;
+				return;
+			}
+		}
+		release(data, bytes);
+	}
+
+	/// <summary>
+	/// Releases every buffer held in the free lists
+	/// </summary>
+	void trim() {
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto& entry : freeLists) {
+			for (void* block : entry.second)
+				release(block, entry.first);
+		}
+		freeLists.clear();
+		held = 0;
+	}
+
+	AllocatorStats stats() const override {
+		AllocatorStats s;
+		s.hits = hits;
+		s.misses = misses;
+		s.bytesHeld = held;
+		s.bytesInUse = inUse;
+		return s;
+	}
+
+	static PoolAllocator& global() {
+		static PoolAllocator allocator;
+		return allocator;
+	}
+};
@@ -0,0 +1,395 @@
+#pragma once
+#include <cstdio>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Matrix.h"
+
+/// <summary>
+/// Lazy expression templates for Matrix arithmetic. Operators on a Matrix build a tree of nodes that is only
+/// evaluated when assigned to a Matrix, so chains of products are reordered to the cheapest parenthesization,
+/// element wise parts are fused into one parallel sweep and the result is written into the destination's buffer.
+/// Nodes hold references to their Matrix operands, so an expression must be used before its operands go away.
+/// </summary>
+namespace expr {
+	struct ExprBase {};
+
+	template<typename E>
+	struct Expr : ExprBase {
+		const E& self() const { return static_cast<const E&>(*this); }
+	};
+
+	/// <summary>
+	/// Operands of a product chain gathered from nested Product nodes, with any scalar factors pulled out
+	/// </summary>
+	struct Chain {
+		std::vector<gemm::Operand> factors; //Transposed Matrix operands are read in place through the transpose flag
+		std::deque<Matrix> temps; //Storage for factors that had to be evaluated, deque keeps views valid
+		double scale = 1;
+	};
+
+	constexpr int SWEEP_LEAF = 32; //Side of the blocks recursiveTiles stops at, 8KB of each operand
+
+	/// <summary>
+	/// Cache oblivious walk of rows [r0, r1) x columns [c0, c1): the longer side is halved until both are at most
+	/// SWEEP_LEAF, then leaf(r0, r1, c0, c1) runs. Blocks at every level are close to square, so an operand read
+	/// column wise reuses the cache lines it brings in at whatever level of the hierarchy the block fits.
+	/// Column splits stay on multiples of 8 from c0 so rows of a block start on the same cache line alignment.
+	/// </summary>
+	template<typename F>
+	void recursiveTiles(int r0, int r1, int c0, int c1, F& leaf) {
+		if (r1 - r0 <= SWEEP_LEAF && c1 - c0 <= SWEEP_LEAF) {
+			leaf(r0, r1, c0, c1);
+		} else if (r1 - r0 >= c1 - c0) {
+			const int mid = r0 + (r1 - r0) / 2;
+			recursiveTiles(r0, mid, c0, c1, leaf);
+			recursiveTiles(mid, r1, c0, c1, leaf);
+		} else {
+			const int mid = c0 + ((c1 - c0) / 2 + 7) / 8 * 8;
+			recursiveTiles(r0, r1, c0, mid, leaf);
+			recursiveTiles(r0, r1, mid, c1, leaf);
+		}
+	}
+
+	/// <summary>
+	/// One parallel sweep over the tiles of dst setting every element to coeff(i, j). With blocked set, because
+	/// some operand is read transposed, each tile is walked by recursiveTiles instead of row by row.
+	/// </summary>
+	template<typename F>
+	void sweep(Matrix& dst, bool blocked, F&& coeff) {
+		auto rows = [&](int r0, int r1, int c0, int c1) {
+			for (int i = r0; i < r1; i++) {
+				double* out = dst.rowPtr(i);
+				for (int j = c0; j < c1; j++)
+					out[j] = coeff(i, j);
+			}
+		};
+		Matrix::context().parallelFor2D(dst.getRows(), dst.getCols(), [&](int r0, int r1, int c0, int c1) {
+			if (blocked)
+				recursiveTiles(r0, r1, c0, c1, rows);
+			else
+				rows(r0, r1, c0, c1);
+			});
+	}
+
+	inline void copyOperand(gemm::Operand src, Matrix& dst) {
+		dst.resize(src.rows(), src.cols());
+		const MatrixView<const double> v = src.view;
+		if (src.trans)
+			sweep(dst, true, [v](int i, int j) { return v(j, i); });
+		else
+			sweep(dst, false, [v](int i, int j) { return v(i, j); });
+	}
+
+	inline void scale(Matrix& dst, double s) {
+		Matrix::context().parallelFor2D(dst.getRows(), dst.getCols(), [&](int r0, int r1, int c0, int c1) {
+			for (int i = r0; i < r1; i++) {
+				double* row = dst.rowPtr(i);
+				for (int j = c0; j < c1; j++)
+					row[j] *= s;
+			}
+			});
+	}
+
+	/// <summary>
+	/// Matrix chain ordering by the classic O(n^3) dynamic program on the factor dimensions.
+	/// split[i * n + j] is the index k where the product of factors i..j is split into (i..k)(k+1..j).
+	/// </summary>
+	inline std::vector<int> chainOrder(const std::vector<gemm::Operand>& factors) {
+		const int n = (int)factors.size();
+		std::vector<double> dims(n + 1);
+		for (int i = 0; i < n; i++)
+			dims[i] = factors[i].rows();
+		dims[n] = factors[n - 1].cols();
+
+		std::vector<double> cost((size_t)n * n, 0.0);
+		std::vector<int> split((size_t)n * n, 0);
+		for (int len = 2; len <= n; len++) {
+			for (int i = 0; i + len - 1 < n; i++) {
+				const int j = i + len - 1;
+				double best = std::numeric_limits<double>::max();
+				for (int k = i; k < j; k++) {
+					double c = cost[i * n + k] + cost[(k + 1) * n + j] + dims[i] * dims[k + 1] * dims[j + 1];
+					if (c < best) {
+						best = c;
+						split[i * n + j] = k;
+					}
+				}
+				cost[i * n + j] = best;
+			}
+		}
+		return split;
+	}
+
+	inline void evalChain(const Chain& chain, const std::vector<int>& split, int i, int j, Matrix& dst, double alpha = 1);
+
+	/// <summary>
+	/// View of the product of factors i..j, a single factor is used in place, longer runs are evaluated into storage
+	/// </summary>
+	inline gemm::Operand chainOperand(const Chain& chain, const std::vector<int>& split, int i, int j, Matrix& storage) {
+		if (i == j)
+			return chain.factors[i];
+		evalChain(chain, split, i, j, storage);
+		return gemm::Operand{ std::as_const(storage).view(), false };
+	}
+
+	inline void evalChain(const Chain& chain, const std::vector<int>& split, int i, int j, Matrix& dst, double alpha) {
+		if (i == j) {
+			copyOperand(chain.factors[i], dst);
+			if (alpha != 1)
+				scale(dst, alpha);
+			return;
+		}
+		const int k = split[i * (int)chain.factors.size() + j];
+		Matrix leftStorage(0, 0), rightStorage(0, 0);
+		gemm::Operand a = chainOperand(chain, split, i, k, leftStorage);
+		gemm::Operand b = chainOperand(chain, split, k + 1, j, rightStorage);
+		dst.resize(a.rows(), b.cols());
+		Matrix::multiplyViews(a, b, dst.view(), alpha, 0);
+	}
+
+	/// <summary>
+	/// Evaluates a node into a temporary and adds it to the chain as a single factor
+	/// </summary>
+	template<typename E>
+	void appendEvaluated(const E& e, Chain& chain) {
+		chain.temps.emplace_back(0, 0);
+		e.evalTo(chain.temps.back());
+		chain.factors.push_back(gemm::Operand{ std::as_const(chain.temps.back()).view(), false });
+	}
+
+	template<typename E>
+	void evalProduct(const E& e, Matrix& dst) {
+		Chain chain;
+		e.appendFactors(chain);
+		std::vector<int> split = chainOrder(chain.factors);
+		evalChain(chain, split, 0, (int)chain.factors.size() - 1, dst, chain.scale);
+	}
+
+	/// <summary>
+	/// One parallel sweep over tiles of the destination computing every coefficient of the expression, in
+	/// cache oblivious blocks when the expression reads anything transposed
+	/// </summary>
+	template<typename E>
+	void evalElementwise(const E& e, Matrix& dst) {
+		e.materialize();
+		dst.resize(e.rows(), e.cols());
+		sweep(dst, E::transposes, [&](int i, int j) { return e.coeff(i, j); });
+	}
+
+	struct Leaf : Expr<Leaf> {
+		static constexpr bool isProduct = false;
+		static constexpr bool transposes = false; //Whether coefficients are read from some Matrix transposed
+		const Matrix& m;
+
+		explicit Leaf(const Matrix& m) : m(m) {}
+		int rows() const { return m.getRows(); }
+		int cols() const { return m.getCols(); }
+		double coeff(int i, int j) const { return m(i, j); }
+		bool checkSizes() const { return true; }
+		bool aliases(const Matrix& dst) const { return &m == &dst; }
+		void materialize() const {}
+		void appendFactors(Chain& chain) const { chain.factors.push_back(gemm::Operand{ m.view(), false }); }
+		void evalTo(Matrix& dst) const { dst = m; }
+	};
+
+	template<typename L, typename R>
+	struct Product : Expr<Product<L, R>> {
+		static constexpr bool isProduct = true;
+		static constexpr bool transposes = false; //Coefficients come from the row major cache
+		L left;
+		R right;
+		mutable std::shared_ptr<Matrix> cache; //Filled by materialize when the product is part of an element wise expression
+
+		Product(const L& left, const R& right) : left(left), right(right) {}
+		int rows() const { return left.rows(); }
+		int cols() const { return right.cols(); }
+		double coeff(int i, int j) const { return (*cache)(i, j); }
+		bool checkSizes() const { return left.checkSizes() && right.checkSizes() && left.cols() == right.rows(); }
+		bool aliases(const Matrix& dst) const { return left.aliases(dst) || right.aliases(dst); }
+		void materialize() const {
+			if (!cache) {
+				cache = std::make_shared<Matrix>(0, 0);
+				evalTo(*cache);
+			}
+		}
+		void appendFactors(Chain& chain) const {
+			left.appendFactors(chain);
+			right.appendFactors(chain);
+		}
+		void evalTo(Matrix& dst) const { evalProduct(*this, dst); }
+	};
+
+	template<typename L, typename R>
+	struct Sum : Expr<Sum<L, R>> {
+		static constexpr bool isProduct = false;
+		static constexpr bool transposes = L::transposes || R::transposes;
+		L left;
+		R right;
+
+		Sum(const L& left, const R& right) : left(left), right(right) {}
+		int rows() const { return left.rows(); }
+		int cols() const { return left.cols(); }
+		double coeff(int i, int j) const { return left.coeff(i, j) + right.coeff(i, j); }
+		bool checkSizes() const {
+			return left.checkSizes() && right.checkSizes() && left.rows() == right.rows() && left.cols() == right.cols();
+		}
+		bool aliases(const Matrix& dst) const { return left.aliases(dst) || right.aliases(dst); }
+		void materialize() const {
+			left.materialize();
+			right.materialize();
+		}
+		void appendFactors(Chain& chain) const { appendEvaluated(*this, chain); }
+		void evalTo(Matrix& dst) const { evalElementwise(*this, dst); }
+	};
+
+	/// <summary>
+	/// Element wise (Hadamard) product, fused into the sweep like Sum
+	/// </summary>
+	template<typename L, typename R>
+	struct Hadamard : Expr<Hadamard<L, R>> {
+		static constexpr bool isProduct = false;
+		static constexpr bool transposes = L::transposes || R::transposes;
+		L left;
+		R right;
+
+		Hadamard(const L& left, const R& right) : left(left), right(right) {}
+		int rows() const { return left.rows(); }
+		int cols() const { return left.cols(); }
+		double coeff(int i, int j) const { return left.coeff(i, j) * right.coeff(i, j); }
+		bool checkSizes() const {
+			return left.checkSizes() && right.checkSizes() && left.rows() == right.rows() && left.cols() == right.cols();
+		}
+		bool aliases(const Matrix& dst) const { return left.aliases(dst) || right.aliases(dst); }
+		void materialize() const {
+			left.materialize();
+			right.materialize();
+		}
+		void appendFactors(Chain& chain) const { appendEvaluated(*this, chain); }
+		void evalTo(Matrix& dst) const { evalElementwise(*this, dst); }
+	};
+
+	template<typename E>
+	struct Scaled : Expr<Scaled<E>> {
+		static constexpr bool isProduct = E::isProduct;
+		static constexpr bool transposes = E::transposes;
+		E child;
+		double s;
+
+		Scaled(const E& child, double s) : child(child), s(s) {}
+		int rows() const { return child.rows(); }
+		int cols() const { return child.cols(); }
+		double coeff(int i, int j) const { return s * child.coeff(i, j); }
+		bool checkSizes() const { return child.checkSizes(); }
+		bool aliases(const Matrix& dst) const { return child.aliases(dst); }
+		void materialize() const { child.materialize(); }
+		void appendFactors(Chain& chain) const {
+			chain.scale *= s;
+			child.appendFactors(chain);
+		}
+		void evalTo(Matrix& dst) const {
+			if constexpr (isProduct)
+				evalProduct(*this, dst);
+			else
+				evalElementwise(*this, dst);
+		}
+	};
+
+	template<typename E>
+	struct Transposed : Expr<Transposed<E>> {
+		static constexpr bool isProduct = false;
+		static constexpr bool transposes = true;
+		E child;
+
+		explicit Transposed(const E& child) : child(child) {}
+		int rows() const { return child.cols(); }
+		int cols() const { return child.rows(); }
+		double coeff(int i, int j) const { return child.coeff(j, i); }
+		bool checkSizes() const { return child.checkSizes(); }
+		bool aliases(const Matrix& dst) const { return child.aliases(dst); }
+		void materialize() const { child.materialize(); }
+		void appendFactors(Chain& chain) const {
+			if constexpr (std::is_same_v<E, Leaf>)
+				chain.factors.push_back(gemm::Operand{ child.m.view(), true });
+			else
+				appendEvaluated(*this, chain);
+		}
+		void evalTo(Matrix& dst) const { evalElementwise(*this, dst); }
+	};
+
+	/// <summary>
+	/// Evaluates an expression into dst, reusing dst's buffer when the shape already matches.
+	/// An expression reading dst is evaluated into a temporary first.
+	/// </summary>
+	template<typename E>
+	void assign(Matrix& dst, const E& e) {
+		if (!e.checkSizes()) {
+			std::printf("Matrix sizes are not matched, expression not possible.");
+			dst = Matrix(0, 0);
+		} else if (e.aliases(dst)) {
+			Matrix result(0, 0);
+			e.evalTo(result);
+			dst = std::move(result);
+		} else {
+			e.evalTo(dst);
+		}
+	}
+
+	template<typename T>
+	constexpr bool isOperand = std::is_same_v<T, Matrix> || std::is_base_of_v<ExprBase, T>;
+
+	inline Leaf node(const Matrix& m) { return Leaf(m); }
+
+	template<typename E>
+	const E& node(const Expr<E>& e) { return e.self(); }
+
+	template<typename T>
+	using Node = std::conditional_t<std::is_same_v<T, Matrix>, Leaf, T>;
+}
+
+template<typename E>
+Matrix::Matrix(const expr::Expr<E>& e) : Matrix(0, 0) {
+	expr::assign(*this, e.self());
+}
+
+template<typename E>
+Matrix& Matrix::operator=(const expr::Expr<E>& e) {
+	expr::assign(*this, e.self());
+	return *this;
+}
+
+template<typename L, typename R, std::enable_if_t<expr::isOperand<L> && expr::isOperand<R>, int> = 0>
+expr::Product<expr::Node<L>, expr::Node<R>> operator*(const L& left, const R& right) {
+	return expr::Product<expr::Node<L>, expr::Node<R>>(expr::node(left), expr::node(right));
+}
+
+template<typename L, typename R, std::enable_if_t<expr::isOperand<L> && expr::isOperand<R>, int> = 0>
+expr::Sum<expr::Node<L>, expr::Node<R>> operator+(const L& left, const R& right) {
+	return expr::Sum<expr::Node<L>, expr::Node<R>>(expr::node(left), expr::node(right));
+}
+
+template<typename T, std::enable_if_t<expr::isOperand<T>, int> = 0>
+expr::Scaled<expr::Node<T>> operator*(double s, const T& operand) {
+	return expr::Scaled<expr::Node<T>>(expr::node(operand), s);
+}
+
+template<typename T, std::enable_if_t<expr::isOperand<T>, int> = 0>
+expr::Scaled<expr::Node<T>> operator*(const T& operand, double s) {
+	return expr::Scaled<expr::Node<T>>(expr::node(operand), s);
+}
+
+template<typename T, std::enable_if_t<expr::isOperand<T>, int> = 0>
+expr::Transposed<expr::Node<T>> transpose(const T& operand) {
+	return expr::Transposed<expr::Node<T>>(expr::node(operand));
+}
+
+/// <summary>
+/// Element wise product of two operands of the same shape, alpha * a + beta * hadamard(b, c) is one sweep
+/// </summary>
+template<typename L, typename R, std::enable_if_t<expr::isOperand<L> && expr::isOperand<R>, int> = 0>
+expr::Hadamard<expr::Node<L>, expr::Node<R>> hadamard(const L& left, const R& right) {
+	return expr::Hadamard<expr::Node<L>, expr::Node<R>>(expr::node(left), expr::node(right));
+}
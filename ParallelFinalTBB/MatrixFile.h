@@ -0,0 +1,318 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "MatrixView.h"
+#include "ExecutionContext.h"
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// <summary>
+/// Binary Matrix files. A 64 byte header is followed by rows * stride doubles in row major order, the stride
+/// padding written as zeros. The data starts on a 64 byte boundary of the file, so a mapping of the file gives
+/// rows aligned the same way as an in memory Matrix and it can be used in place.
+///
+///     offset  size  field
+///          0     8  magic "PFMATRIX"
+///          8     4  version, currently 1
+///         12     4  dtype, 1 = float64
+///         16     4  header size in bytes
+///         20     4  alignment of the data in bytes
+///         24     4  rows
+///         28     4  cols
+///         32     4  stride in elements, at least cols
+///         36     4  byte order tag 0x01020304 as written
+///         40     8  offset of the data
+///         48     8  size of the data in bytes
+///         56     8  reserved, zero
+/// </summary>
+namespace matrixfile {
+	constexpr char MAGIC[8] = { 'P', 'F', 'M', 'A', 'T', 'R', 'I', 'X' };
+	constexpr uint32_t VERSION = 1;
+	constexpr uint32_t DTYPE_FLOAT64 = 1;
+	constexpr uint32_t BYTE_ORDER_TAG = 0x01020304;
+	constexpr uint32_t ALIGNMENT = 64;
+	constexpr size_t WRITE_CHUNK = (size_t)4 << 20; //Bytes of rows written by one task
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t dtype;
+		uint32_t headerBytes;
+		uint32_t alignment;
+		int32_t rows;
+		int32_t cols;
+		int32_t stride;
+		uint32_t byteOrder;
+		uint64_t dataOffset;
+		uint64_t dataBytes;
+		uint64_t reserved;
+	};
+	static_assert(sizeof(Header) == 64, "Matrix file header must be 64 bytes");
+
+	inline Header makeHeader(int rows, int cols, int stride) {
+		Header h = {};
+		std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+		h.version = VERSION;
+		h.dtype = DTYPE_FLOAT64;
+		h.headerBytes = sizeof(Header);
+		h.alignment = ALIGNMENT;
+		h.rows = rows;
+		h.cols = cols;
+		h.stride = stride;
+		h.byteOrder = BYTE_ORDER_TAG;
+		h.dataOffset = sizeof(Header);
+		h.dataBytes = (uint64_t)rows * stride * sizeof(double);
+		return h;
+	}
+
+	/// <summary>
+	/// Checks a header read from a file of the given size, printing the reason when it is rejected
+	/// </summary>
+	inline bool validate(const Header& h, uint64_t fileBytes) {
+		if (fileBytes < sizeof(Header) || std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0) {
+			std::printf("Not a Matrix file.");
+			return false;
+		}
+		if (h.version != VERSION || h.dtype != DTYPE_FLOAT64 || h.byteOrder != BYTE_ORDER_TAG) {
+			std::printf("Matrix file version, dtype or byte order is not supported.");
+			return false;
+		}
+		//Sizes are bounded by the file before they are multiplied or added, so a corrupt header cannot wrap them
+		if (h.rows < 0 || h.cols < 0 || h.stride < h.cols || h.dataOffset % ALIGNMENT != 0
+			|| (h.stride > 0 && (uint64_t)h.rows > fileBytes / sizeof(double) / (uint64_t)h.stride)
+			|| h.dataBytes != (uint64_t)h.rows * h.stride * sizeof(double)
+			|| h.dataOffset > fileBytes || h.dataBytes > fileBytes - h.dataOffset) {
+			std::printf("Matrix file is truncated or corrupt.");
+			return false;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Read only mapping of a whole file, unmapped when the last owner goes away
+	/// </summary>
+	class MappedFile {
+		const char* base = nullptr;
+		uint64_t bytes = 0;
+#if defined(_WIN32)
+		HANDLE mapping = nullptr;
+#endif
+	public:
+		explicit MappedFile(const std::string& path) {
+#if defined(_WIN32)
+			HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+				FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				return;
+			LARGE_INTEGER size;
+			if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+				mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (mapping) {
+					base = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+					bytes = base ? (uint64_t)size.QuadPart : 0;
+				}
+			}
+			CloseHandle(file);
+#else
+			const int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (file < 0)
+				return;
+			struct stat info;
+			if (fstat(file, &info) == 0 && info.st_size > 0) {
+				void* address = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+				if (address != MAP_FAILED) {
+					base = static_cast<const char*>(address);
+					bytes = (uint64_t)info.st_size;
+				}
+			}
+			close(file);
+#endif
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		~MappedFile() {
+#if defined(_WIN32)
+			if (base)
+				UnmapViewOfFile(base);
+			if (mapping)
+				CloseHandle(mapping);
+#else
+			if (base)
+				munmap(const_cast<char*>(base), (size_t)bytes);
+#endif
+		}
+
+		bool isOpen() const { return base != nullptr; }
+		const char* data() const { return base; }
+		uint64_t size() const { return bytes; }
+	};
+
+	/// <summary>
+	/// File written at explicit offsets, so several threads can write disjoint ranges at once
+	/// </summary>
+	class FileWriter {
+#if defined(_WIN32)
+		HANDLE file = INVALID_HANDLE_VALUE;
+#else
+		int file = -1;
+#endif
+		std::atomic<bool> error{ false };
+	public:
+		explicit FileWriter(const std::string& path) {
+#if defined(_WIN32)
+			file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+#else
+			file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+		}
+
+		FileWriter(const FileWriter&) = delete;
+		FileWriter& operator=(const FileWriter&) = delete;
+
+		~FileWriter() {
+			close();
+		}
+
+		bool isOpen() const {
+#if defined(_WIN32)
+			return file != INVALID_HANDLE_VALUE;
+#else
+			return file >= 0;
+#endif
+		}
+
+		bool failed() const { return error; }
+
+		void writeAt(uint64_t offset, const void* source, size_t length) {
+			const char* bytes = static_cast<const char*>(source);
+			size_t done = 0;
+			while (done < length && !error) {
+#if defined(_WIN32)
+				OVERLAPPED position = {};
+				position.Offset = (DWORD)(offset + done);
+				position.OffsetHigh = (DWORD)((offset + done) >> 32);
+				const DWORD request = (DWORD)std::min<size_t>(length - done, (size_t)1 << 30);
+				DWORD put = 0;
+				if (!WriteFile(file, bytes + done, request, &put, &position) || put == 0)
+					error = true;
+#else
+				const ssize_t put = pwrite(file, bytes + done, length - done, (off_t)(offset + done));
+				if (put <= 0)
+					error = true;
+#endif
+				else
+					done += (size_t)put;
+			}
+		}
+
+		/// <returns>false if a write or closing the file failed</returns>
+		bool close() {
+			if (!isOpen())
+				return !error;
+#if defined(_WIN32)
+			if (!CloseHandle(file))
+				error = true;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (::close(file) != 0)
+				error = true;
+			file = -1;
+#endif
+			return !error;
+		}
+	};
+
+	/// <summary>
+	/// Writes m to path. Row blocks of about WRITE_CHUNK bytes are staged with zeroed padding and written
+	/// in parallel at their offsets.
+	/// </summary>
+	inline bool write(const std::string& path, MatrixView<const double> m, ExecutionContext& ctx) {
+		const int lanes = (int)(ALIGNMENT / sizeof(double));
+		const int stride = (m.cols + lanes - 1) / lanes * lanes;
+		FileWriter writer(path);
+		if (!writer.isOpen()) {
+			std::printf("Could not open %s for writing.", path.c_str());
+			return false;
+		}
+		const Header header = makeHeader(m.rows, m.cols, stride);
+		writer.writeAt(0, &header, sizeof(header));
+
+		const size_t rowBytes = (size_t)stride * sizeof(double);
+		const int rowsPerChunk = (int)std::max<size_t>(1, WRITE_CHUNK / std::max<size_t>(rowBytes, 1));
+		const int chunks = (m.rows + rowsPerChunk - 1) / rowsPerChunk;
+		ctx.parallelFor(chunks, [&](int c) {
+			const int first = c * rowsPerChunk;
+			const int count = std::min(rowsPerChunk, m.rows - first);
+			std::vector<double> staging((size_t)count * stride, 0.0);
+			for (int i = 0; i < count; i++)
+				std::memcpy(staging.data() + (size_t)i * stride, m.rowPtr(first + i), sizeof(double) * m.cols);
+			writer.writeAt(header.dataOffset + (uint64_t)first * rowBytes, staging.data(), staging.size() * sizeof(double));
+			});
+
+		if (!writer.close()) {
+			std::printf("Writing %s failed.", path.c_str());
+			return false;
+		}
+		return true;
+	}
+}
+
+/// <summary>
+/// Read only Matrix backed by a mapping of a Matrix file, the data is paged in on first access and never copied.
+/// Copies share the mapping, which stays valid until the last copy goes away.
+/// </summary>
+class MappedMatrix {
+	std::shared_ptr<const matrixfile::MappedFile> file;
+	MatrixView<const double> data{ nullptr, 0, 0, 0 };
+
+public:
+	MappedMatrix() = default;
+
+	/// <summary>
+	/// Maps path, an invalid MappedMatrix is returned when the file cannot be mapped or is not a Matrix file
+	/// </summary>
+	static MappedMatrix open(const std::string& path) {
+		MappedMatrix result;
+		auto mapped = std::make_shared<const matrixfile::MappedFile>(path);
+		if (!mapped->isOpen()) {
+			std::printf("Could not map %s.", path.c_str());
+			return result;
+		}
+		matrixfile::Header header = {};
+		if (mapped->size() >= sizeof(header))
+			std::memcpy(&header, mapped->data(), sizeof(header));
+		if (!matrixfile::validate(header, mapped->size()))
+			return result;
+		const double* first = reinterpret_cast<const double*>(mapped->data() + header.dataOffset);
+		result.data = MatrixView<const double>{ first, header.rows, header.cols, header.stride };
+		result.file = std::move(mapped);
+		return result;
+	}
+
+	bool isValid() const { return file != nullptr; }
+
+	int getRows() const { return data.rows; }
+	int getCols() const { return data.cols; }
+	int getStride() const { return data.stride; }
+
+	const double& operator()(int i, int j) const { return data(i, j); }
+	const double* rowPtr(int i) const { return data.rowPtr(i); }
+	MatrixView<const double> view() const { return data; }
+};
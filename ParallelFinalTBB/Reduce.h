@@ -0,0 +1,157 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include "ExecutionContext.h"
+
+/// <summary>
+/// Parallel reductions over arrays of doubles. The input is cut into fixed size chunks that are reduced as
+/// independent tasks, each chunk by pairwise summation over multi accumulator leaves the compiler can vectorize,
+/// and the chunk partials are then combined pairwise. Chunk boundaries do not depend on the thread count,
+/// so results are bit identical for any number of workers and the error grows with log(n) rather than n.
+/// </summary>
+namespace reduce {
+	constexpr size_t CHUNK = (size_t)1 << 16; //Elements reduced by one task
+	constexpr size_t LEAF = 256;              //Pairwise recursion stops at this many elements
+	constexpr int LANES = 8;                  //Independent accumulators in a leaf
+
+	/// <summary>
+	/// Mean and sum of squared deviations of a set of values, merged with Chan's parallel update
+	/// </summary>
+	struct Moments {
+		double count = 0;
+		double mean = 0;
+		double m2 = 0;
+
+		double variance() const { return count > 0 ? m2 / count : 0; }
+		double sampleVariance() const { return count > 1 ? m2 / (count - 1) : 0; }
+
+		static Moments merge(const Moments& a, const Moments& b) {
+			if (a.count == 0)
+				return b;
+			if (b.count == 0)
+				return a;
+			Moments result;
+			const double delta = b.mean - a.mean;
+			result.count = a.count + b.count;
+			result.mean = a.mean + delta * (b.count / result.count);
+			result.m2 = a.m2 + b.m2 + delta * delta * (a.count * b.count / result.count);
+			return result;
+		}
+	};
+
+	template<typename F>
+	double leafSum(const double* x, size_t n, F f) {
+		double acc[LANES] = {};
+		size_t i = 0;
+		for (; i + LANES <= n; i += LANES) {
+			for (int k = 0; k < LANES; k++)
+				acc[k] += f(x[i + k]);
+		}
+		for (int k = 0; i < n; i++, k++)
+			acc[k] += f(x[i]);
+		return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+	}
+
+	/// <summary>
+	/// Sum of f(x[i]) by pairwise summation, splits are kept on LANES boundaries
+	/// </summary>
+	template<typename F>
+	double pairwiseSum(const double* x, size_t n, F f) {
+		if (n <= LEAF)
+			return leafSum(x, n, f);
+		const size_t half = n / 2 / LANES * LANES;
+		return pairwiseSum(x, half, f) + pairwiseSum(x + half, n - half, f);
+	}
+
+	/// <summary>
+	/// Pairwise combination of partial results in index order
+	/// </summary>
+	template<typename T, typename C>
+	T combinePairwise(std::vector<T> partials, C combine) {
+		if (partials.empty())
+			return T();
+		for (size_t width = 1; width < partials.size(); width *= 2) {
+			for (size_t i = 0; i + width < partials.size(); i += 2 * width)
+				partials[i] = combine(partials[i], partials[i + width]);
+		}
+		return partials[0];
+	}
+
+	inline int chunkCount(size_t count) {
+		return (int)((count + CHUNK - 1) / CHUNK);
+	}
+
+	/// <summary>
+	/// Sum of f(x[i]) for i in [0, count), one task per chunk
+	/// </summary>
+	template<typename F>
+	double transformSum(const double* x, size_t count, F f, ExecutionContext& ctx = ExecutionContext::global()) {
+		std::vector<double> partials(chunkCount(count));
+		ctx.parallelFor((int)partials.size(), [&](int c) {
+			const size_t first = (size_t)c * CHUNK;
+			partials[c] = pairwiseSum(x + first, std::min(CHUNK, count - first), f);
+			});
+		return combinePairwise(std::move(partials), [](double a, double b) { return a + b; });
+	}
+
+	inline double sum(const double* x, size_t count, ExecutionContext& ctx = ExecutionContext::global()) {
+		return transformSum(x, count, [](double v) { return v; }, ctx);
+	}
+
+	inline double sumSquares(const double* x, size_t count, ExecutionContext& ctx = ExecutionContext::global()) {
+		return transformSum(x, count, [](double v) { return v * v; }, ctx);
+	}
+
+	inline double rms(const double* x, size_t count, ExecutionContext& ctx = ExecutionContext::global()) {
+		return count ? std::sqrt(sumSquares(x, count, ctx) / count) : 0;
+	}
+
+	/// <summary>
+	/// Moments of at most one chunk, two passes around the chunk's own mean while it is in cache,
+	/// which avoids the cancellation of the sum of squares formula
+	/// </summary>
+	inline Moments chunkMoments(const double* x, size_t n) {
+		Moments m;
+		if (n == 0)
+			return m;
+		m.count = (double)n;
+		m.mean = pairwiseSum(x, n, [](double v) { return v; }) / n;
+		const double mean = m.mean;
+		m.m2 = pairwiseSum(x, n, [mean](double v) { return (v - mean) * (v - mean); });
+		return m;
+	}
+
+	/// <summary>
+	/// Mean and variance, one task per chunk
+	/// </summary>
+	inline Moments moments(const double* x, size_t count, ExecutionContext& ctx = ExecutionContext::global()) {
+		std::vector<Moments> partials(chunkCount(count));
+		ctx.parallelFor((int)partials.size(), [&](int c) {
+			const size_t first = (size_t)c * CHUNK;
+			partials[c] = chunkMoments(x + first, std::min(CHUNK, count - first));
+			});
+		return combinePairwise(std::move(partials), Moments::merge);
+	}
+
+	/// <summary>
+	/// Same as moments but on the calling thread, for callers that already run one task per block
+	/// </summary>
+	inline Moments blockMoments(const double* x, size_t count) {
+		std::vector<Moments> partials(chunkCount(count));
+		for (size_t c = 0; c < partials.size(); c++) {
+			const size_t first = c * CHUNK;
+			partials[c] = chunkMoments(x + first, std::min(CHUNK, count - first));
+		}
+		return combinePairwise(std::move(partials), Moments::merge);
+	}
+
+	inline double mean(const double* x, size_t count, ExecutionContext& ctx = ExecutionContext::global()) {
+		return count ? sum(x, count, ctx) / count : 0;
+	}
+
+	inline double variance(const double* x, size_t count, ExecutionContext& ctx = ExecutionContext::global()) {
+		return moments(x, count, ctx).variance();
+	}
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <tbb/tbb.h>
+#include "MatrixView.h"
+#include "Gemm.h"
+#include "ExecutionContext.h"
+
+/// <summary>
+/// Opt-in Strassen-Winograd multiplication (7 products and 15 additions per level) for large products.
+/// Each level splits A, B and C into quadrants, zero padding odd sizes, and runs the 7 half size products
+/// as tasks of a tbb::task_group. Products whose smallest dimension is at or below the crossover use the
+/// blocked GEMM engine.
+///
+/// Error bound: unlike the classic kernel the bound is only normwise, not per element. Following Higham,
+/// Accuracy and Stability of Numerical Algorithms, ch. 23, for n x n operands and crossover n0
+///     ||C - C'|| <= [(n / n0)^log2(18) * (n0^2 + 6 n0) - 6 n] u ||A|| ||B|| + O(u^2)
+/// with u = 2^-53 and the max norm, against n u |A| |B| for the classic kernel. Each level multiplies the
+/// constant by about 18, so a larger crossover trades speed for accuracy. Elements of C much smaller than
+/// ||A|| ||B|| can lose most of their relative accuracy.
+/// </summary>
+namespace strassen {
+	struct Config {
+		bool enabled = false;
+		int crossover = 256;
+	};
+
+	inline Config& config() {
+		static Config settings;
+		return settings;
+	}
+
+	/// <summary>
+	/// Enables or disables the Strassen mode for Matrix multiplications
+	/// </summary>
+	inline void setEnabled(bool enabled, int crossover = 256) {
+		config().enabled = enabled;
+		config().crossover = std::max(crossover, 16);
+	}
+
+	/// <summary>
+	/// Uninitialized scratch matrix with its stride padded to whole cache lines, every use overwrites it fully
+	/// </summary>
+	class Buffer {
+		std::unique_ptr<double[]> storage;
+		int rows, cols, stride;
+	public:
+		Buffer(int rows, int cols) : rows(rows), cols(cols), stride((cols + 7) / 8 * 8) {
+			storage.reset(new double[(size_t)rows * stride]);
+		}
+		MatrixView<double> view() { return MatrixView<double>{ storage.get(), rows, cols, stride }; }
+		MatrixView<const double> view() const { return MatrixView<const double>{ storage.get(), rows, cols, stride }; }
+	};
+
+	/// <summary>
+	/// Quadrant (qi, qj) of a view split at (splitRow, splitCol), clipped to the view's edges
+	/// </summary>
+	template<typename T>
+	MatrixView<T> quadrant(MatrixView<T> v, int splitRow, int splitCol, int qi, int qj) {
+		const int row = qi ? splitRow : 0;
+		const int col = qj ? splitCol : 0;
+		const int nrows = qi ? v.rows - splitRow : splitRow;
+		const int ncols = qj ? v.cols - splitCol : splitCol;
+		return v.block(row, col, nrows, ncols);
+	}
+
+	/// <summary>
+	/// out = x + sign * y where x and y are read as zero past their edges
+	/// </summary>
+	inline void combine(MatrixView<double> out, MatrixView<const double> x, MatrixView<const double> y, double sign) {
+		for (int i = 0; i < out.rows; i++) {
+			double* row = out.rowPtr(i);
+			const double* xr = i < x.rows ? x.rowPtr(i) : nullptr;
+			const double* yr = i < y.rows ? y.rowPtr(i) : nullptr;
+			const int xc = xr ? std::min(x.cols, out.cols) : 0;
+			const int yc = yr ? std::min(y.cols, out.cols) : 0;
+			const int both = std::min(xc, yc);
+			int j = 0;
+			for (; j < both; j++)
+				row[j] = xr[j] + sign * yr[j];
+			for (; j < xc; j++)
+				row[j] = xr[j];
+			for (; j < yc; j++)
+				row[j] = sign * yr[j];
+			for (; j < out.cols; j++)
+				row[j] = 0;
+		}
+	}
+
+	/// <summary>
+	/// x padded with zeros to rows x cols. Quadrants that already have that shape are used in place.
+	/// </summary>
+	inline MatrixView<const double> padded(MatrixView<const double> x, int rows, int cols, std::vector<Buffer>& storage) {
+		if (x.rows == rows && x.cols == cols)
+			return x;
+		storage.emplace_back(rows, cols);
+		combine(storage.back().view(), x, MatrixView<const double>{ nullptr, 0, 0, 0 }, 0);
+		return storage.back().view();
+	}
+
+	inline void classic(MatrixView<const double> a, MatrixView<const double> b, MatrixView<double> c, ExecutionContext& ctx) {
+		gemm::multiply(gemm::Operand{ a, false }, gemm::Operand{ b, false }, c, 1, 0, [&](int count, auto&& body) {
+			ctx.parallelFor(count, body);
+			});
+	}
+
+	/// <summary>
+	/// c = a * b, one recursion level. The 7 products are run in a task group and waited on before C is assembled.
+	/// </summary>
+	inline void recurse(MatrixView<const double> a, MatrixView<const double> b, MatrixView<double> c,
+		int crossover, ExecutionContext& ctx) {
+		const int m = a.rows, k = a.cols, n = b.cols;
+		if (std::min({ m, k, n }) <= crossover) {
+			classic(a, b, c, ctx);
+			return;
+		}
+
+		const int hm = (m + 1) / 2, hk = (k + 1) / 2, hn = (n + 1) / 2;
+		auto A = [&](int i, int j) { return quadrant(a, hm, hk, i, j); };
+		auto B = [&](int i, int j) { return quadrant(b, hk, hn, i, j); };
+
+		Buffer s1(hm, hk), s2(hm, hk), s3(hm, hk), s4(hm, hk);
+		Buffer t1(hk, hn), t2(hk, hn), t3(hk, hn), t4(hk, hn);
+		std::vector<Buffer> pads;
+		pads.reserve(4);
+		combine(s1.view(), A(1, 0), A(1, 1), 1);
+		combine(s2.view(), s1.view(), A(0, 0), -1);
+		combine(s3.view(), A(0, 0), A(1, 0), -1);
+		combine(s4.view(), A(0, 1), s2.view(), -1);
+		combine(t1.view(), B(0, 1), B(0, 0), -1);
+		combine(t2.view(), B(1, 1), t1.view(), -1);
+		combine(t3.view(), B(1, 1), B(0, 1), -1);
+		combine(t4.view(), t2.view(), B(1, 0), -1);
+		//Edge quadrants padded to the half size so every product has the same shape
+		MatrixView<const double> a12 = padded(A(0, 1), hm, hk, pads);
+		MatrixView<const double> a22 = padded(A(1, 1), hm, hk, pads);
+		MatrixView<const double> b21 = padded(B(1, 0), hk, hn, pads);
+		MatrixView<const double> b22 = padded(B(1, 1), hk, hn, pads);
+
+		std::vector<Buffer> p;
+		for (int i = 0; i < 7; i++)
+			p.emplace_back(hm, hn);
+		const MatrixView<const double> left[7] = { A(0, 0), a12, s4.view(), a22, s1.view(), s2.view(), s3.view() };
+		const MatrixView<const double> right[7] = { B(0, 0), b21, b22, t4.view(), t1.view(), t2.view(), t3.view() };
+
+		tbb::task_group group;
+		for (int i = 0; i < 7; i++) {
+			group.run([&, i]() {
+				recurse(left[i], right[i], p[i].view(), crossover, ctx);
+				});
+		}
+		group.wait();
+
+		//U1 = P1 + P2, U2 = P1 + P6, U3 = U2 + P7, U4 = U2 + P5, U5 = U4 + P3, U6 = U3 - P4, U7 = U3 + P5
+		Buffer u2(hm, hn), u3(hm, hn), u4(hm, hn);
+		combine(u2.view(), p[0].view(), p[5].view(), 1);
+		combine(u3.view(), u2.view(), p[6].view(), 1);
+		combine(u4.view(), u2.view(), p[4].view(), 1);
+
+		MatrixView<double> c11 = quadrant(c, hm, hn, 0, 0), c12 = quadrant(c, hm, hn, 0, 1);
+		MatrixView<double> c21 = quadrant(c, hm, hn, 1, 0), c22 = quadrant(c, hm, hn, 1, 1);
+		combine(c11, p[0].view(), p[1].view(), 1);
+		combine(c12, u4.view(), p[2].view(), 1);
+		combine(c21, u3.view(), p[3].view(), -1);
+		combine(c22, u3.view(), p[4].view(), 1);
+	}
+
+	/// <summary>
+	/// True when the Strassen mode is enabled and the product is large enough to take at least one level
+	/// </summary>
+	inline bool applies(int m, int k, int n) {
+		return config().enabled && std::min({ m, k, n }) > config().crossover;
+	}
+
+	/// <summary>
+	/// c = a * b by Strassen-Winograd down to the configured crossover
+	/// </summary>
+	inline void multiply(MatrixView<const double> a, MatrixView<const double> b, MatrixView<double> c, ExecutionContext& ctx) {
+		const int crossover = config().crossover;
+		ctx.execute([&]() {
+			recurse(a, b, c, crossover, ctx);
+			});
+	}
+}
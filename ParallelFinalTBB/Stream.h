@@ -0,0 +1,119 @@
+#pragma once
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <tbb/parallel_pipeline.h>
+#include "BlockReader.h"
+#include "ExecutionContext.h"
+#include "Reduce.h"
+#include "Trace.h"
+
+/// <summary>
+/// Out of core processing of files too large for memory. A three stage tbb::parallel_pipeline reads the file in
+/// blocks (serial), processes whole blocks (parallel) and collects the per block results in file order (serial).
+/// At most lines tokens are live and block n uses buffer n % lines, so memory stays at lines * block size while
+/// the reader works ahead of the blocks being processed.
+/// </summary>
+namespace stream {
+	constexpr size_t BLOCK = (size_t)1 << 21; //Doubles per block, 16MB
+	constexpr size_t LINES = 4;               //Blocks in flight
+
+	/// <summary>
+	/// Calls process(block, count) for every block of a file of doubles and stores the results in file order.
+	/// Returns false when the file cannot be opened or read.
+	/// </summary>
+	template<typename R, typename P>
+	bool reduceBlocks(const std::string& path, P process, std::vector<R>& results, size_t blockElements = BLOCK,
+		size_t lines = LINES, ExecutionContext& ctx = ExecutionContext::global()) {
+		BlockReader reader(path, blockElements);
+		if (!reader.isOpen()) {
+			std::printf("Could not open %s for reading.", path.c_str());
+			return false;
+		}
+		results.clear();
+		results.reserve(reader.blocks());
+
+		std::vector<std::unique_ptr<double[]>> buffers(lines);
+		for (auto& buffer : buffers)
+			buffer.reset(new double[blockElements]);
+		std::vector<size_t> sizes(lines);
+		std::vector<R> partials(lines);
+
+		//Results are collected in order, so when block n is read block n - lines has left the pipeline
+		size_t next = 0;
+		ctx.execute([&]() {
+			tbb::parallel_pipeline(lines,
+				tbb::make_filter<void, size_t>(
+					tbb::filter_mode::serial_in_order,
+					[&](tbb::flow_control& fc) -> size_t {
+						trace::Scope stage("read", "pipeline");
+						const size_t slot = next % lines;
+						sizes[slot] = reader.read(next, buffers[slot].get());
+						if (sizes[slot] == 0) {
+							fc.stop();
+							return 0;
+						}
+						return next++;
+					}
+					) &
+				tbb::make_filter<size_t, size_t>(
+					tbb::filter_mode::parallel,
+					[&](size_t block) {
+						trace::Scope stage("process", "pipeline");
+						const size_t slot = block % lines;
+						partials[slot] = process(static_cast<const double*>(buffers[slot].get()), sizes[slot]);
+						return slot;
+					}
+					) &
+				tbb::make_filter<size_t, void>(
+					tbb::filter_mode::serial_in_order,
+					[&](size_t slot) {
+						trace::Scope stage("collect", "pipeline");
+						results.push_back(partials[slot]);
+					}
+					)
+				);
+			});
+
+		if (reader.failed()) {
+			std::printf("Reading %s failed.", path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Statistics of a whole file, merged pairwise from per block partials
+	/// </summary>
+	struct Stats {
+		reduce::Moments moments;
+		double sumSquares = 0;
+		size_t blocks = 0;
+
+		double rms() const { return moments.count > 0 ? std::sqrt(sumSquares / moments.count) : 0; }
+	};
+
+	inline bool statistics(const std::string& path, Stats& out, size_t blockElements = BLOCK, size_t lines = LINES,
+		ExecutionContext& ctx = ExecutionContext::global()) {
+		std::vector<Stats> partials;
+		auto process = [](const double* block, size_t count) {
+			Stats s;
+			s.moments = reduce::blockMoments(block, count);
+			s.sumSquares = reduce::pairwiseSum(block, count, [](double v) { return v * v; });
+			s.blocks = 1;
+			return s;
+		};
+		if (!reduceBlocks(path, process, partials, blockElements, lines, ctx))
+			return false;
+		out = reduce::combinePairwise(std::move(partials), [](const Stats& a, const Stats& b) {
+			Stats s;
+			s.moments = reduce::Moments::merge(a.moments, b.moments);
+			s.sumSquares = a.sumSquares + b.sumSquares;
+			s.blocks = a.blocks + b.blocks;
+			return s;
+			});
+		return true;
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <memory>
+#include <utility>
+#include <vector>
+#include <tbb/flow_graph.h>
+#include "ExecutionContext.h"
+#include "Trace.h"
+
+/// <summary>
+/// Dependency graph of tasks built once and run once, the common surface over the backend's own graph type
+/// so algorithms such as the tiled factorizations (Factorization.h) are written once. Here every task is a
+/// tbb::flow::continue_node and an edge is tbb::flow::make_edge, a node fires once it has received a message
+/// from each of its predecessors. Nodes without predecessors are started by run. The graph is created inside
+/// the context's arena so its tasks run on that arena's threads.
+/// </summary>
+class TaskGraph {
+	using Node = tbb::flow::continue_node<tbb::flow::continue_msg>;
+
+	ExecutionContext& ctx;
+	std::unique_ptr<tbb::flow::graph> graph;
+	std::vector<std::unique_ptr<Node>> nodes; //Declared after the graph, so destroyed before it
+	std::vector<bool> hasPredecessor;
+
+public:
+	explicit TaskGraph(ExecutionContext& ctx) : ctx(ctx) {
+		ctx.execute([&]() { graph = std::make_unique<tbb::flow::graph>(); });
+	}
+	TaskGraph(const TaskGraph&) = delete;
+	TaskGraph& operator=(const TaskGraph&) = delete;
+
+	/// <summary>
+	/// Adds body as a task, name must be a literal and shows up in traces
+	/// </summary>
+	/// <returns>Index of the task for precede</returns>
+	template<typename F>
+	int add(const char* name, F&& body) {
+		nodes.push_back(std::make_unique<Node>(*graph, [name, body = std::forward<F>(body)](const tbb::flow::continue_msg&) {
+			trace::Scope span(name, "task");
+			body();
+			}));
+		hasPredecessor.push_back(false);
+		return (int)nodes.size() - 1;
+	}
+
+	/// <summary>
+	/// before finishes before after starts
+	/// </summary>
+	void precede(int before, int after) {
+		tbb::flow::make_edge(*nodes[before], *nodes[after]);
+		hasPredecessor[after] = true;
+	}
+
+	int size() const { return (int)nodes.size(); }
+
+	/// <summary>
+	/// Runs every task in the context's arena and waits for the graph to finish
+	/// </summary>
+	void run() {
+		ctx.execute([&]() {
+			for (size_t n = 0; n < nodes.size(); n++) {
+				if (!hasPredecessor[n])
+					nodes[n]->try_put(tbb::flow::continue_msg());
+			}
+			graph->wait_for_all();
+			});
+	}
+};
@@ -0,0 +1,166 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Timeline of what every thread ran, exported in the Chrome trace event format (chrome://tracing, Perfetto).
+/// Spans come from three sources: the backend's scheduler observer (set up by ExecutionContext::setTracing),
+/// the chunks of ExecutionContext::parallelFor, and Scope markers placed around stages such as the serial
+/// pipeline filters. Each thread appends to its own buffer, so recording takes no lock, and nothing at all
+/// is recorded while tracing is off apart from one relaxed load per marker.
+/// </summary>
+namespace trace {
+	struct Event {
+		std::string name;
+		const char* category;
+		int64_t beginNs;
+		int64_t endNs;
+		int64_t loop;     //parallelFor call a chunk belongs to, -1 for other spans
+		int thread;       //Index of the recording thread's buffer
+	};
+
+	struct ThreadBuffer {
+		int thread;
+		std::string name;
+		std::vector<Event> events;
+	};
+
+	inline std::string escape(const std::string& text) {
+		std::string out;
+		for (char c : text) {
+			if (c == '"' || c == '\\')
+				out += '\\';
+			if ((unsigned char)c >= 0x20)
+				out += c;
+		}
+		return out;
+	}
+
+	/// <summary>
+	/// The process wide event store. There is only the global instance, the thread's buffer is cached in a thread_local.
+	/// </summary>
+	class Recorder {
+		std::mutex lock; //Guards the list of buffers, not their contents
+		std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+		std::atomic<bool> on{ false };
+		std::atomic<int64_t> loops{ 0 };
+		const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+		Recorder() = default;
+
+	public:
+		bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+		int64_t now() const {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+		}
+
+		int64_t nextLoop() { return loops.fetch_add(1, std::memory_order_relaxed); }
+
+		/// <summary>
+		/// The calling thread's buffer, created on its first event
+		/// </summary>
+		ThreadBuffer& local() {
+			thread_local ThreadBuffer* buffer = nullptr;
+			if (!buffer) {
+				std::lock_guard<std::mutex> guard(lock);
+				buffers.push_back(std::make_unique<ThreadBuffer>());
+				buffer = buffers.back().get();
+				buffer->thread = (int)buffers.size() - 1;
+				buffer->name = "thread " + std::to_string(buffer->thread);
+			}
+			return *buffer;
+		}
+
+		void record(std::string name, const char* category, int64_t beginNs, int64_t endNs, int64_t loop = -1) {
+			ThreadBuffer& buffer = local();
+			buffer.events.push_back(Event{ std::move(name), category, beginNs, endNs, loop, buffer.thread });
+		}
+
+		/// <summary>
+		/// Label shown for the calling thread's row of the timeline
+		/// </summary>
+		void nameThread(const std::string& name) { local().name = name; }
+
+		/// <summary>
+		/// Drops earlier events and starts recording. No traced work may be running.
+		/// </summary>
+		void start() {
+			std::lock_guard<std::mutex> guard(lock);
+			for (auto& buffer : buffers)
+				buffer->events.clear();
+			on = true;
+		}
+
+		/// <summary>
+		/// Stops recording. Events are kept until the next start.
+		/// </summary>
+		void stop() { on = false; }
+
+		/// <summary>
+		/// Writes complete ("X") events and thread names as Chrome trace JSON. Recording must be stopped
+		/// and the traced work finished. Chunks carry their parallelFor call in args.loop, a loop whose chunks
+		/// sit on several rows was spread over those workers, gaps in a row are idle time.
+		/// </summary>
+		/// <returns>false if the file could not be written</returns>
+		bool writeChrome(const std::string& path) {
+			std::lock_guard<std::mutex> guard(lock);
+			std::FILE* file = std::fopen(path.c_str(), "w");
+			if (!file) {
+				std::printf("Could not open %s for writing.\n", path.c_str());
+				return false;
+			}
+			std::fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+			bool first = true;
+			for (const auto& buffer : buffers) {
+				std::fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+					first ? "" : ",", buffer->thread, escape(buffer->name).c_str());
+				first = false;
+				for (const Event& e : buffer->events) {
+					std::fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+						"\"ts\": %.3f, \"dur\": %.3f", escape(e.name).c_str(), e.category, e.thread, e.beginNs / 1000.0,
+						(e.endNs - e.beginNs) / 1000.0);
+					if (e.loop >= 0)
+						std::fprintf(file, ", \"args\": {\"loop\": %lld}", (long long)e.loop);
+					std::fprintf(file, "}");
+				}
+			}
+			std::fprintf(file, "\n]}\n");
+			return std::fclose(file) == 0;
+		}
+
+		static Recorder& global() {
+			static Recorder recorder;
+			return recorder;
+		}
+	};
+
+	inline bool enabled() { return Recorder::global().enabled(); }
+
+	/// <summary>
+	/// Records the lifetime of the scope as one span on the current thread, name must be a literal or outlive the scope
+	/// </summary>
+	class Scope {
+		const char* name;
+		const char* category;
+		int64_t begin = -1;
+
+	public:
+		explicit Scope(const char* name, const char* category = "marker") : name(name), category(category) {
+			if (enabled())
+				begin = Recorder::global().now();
+		}
+		~Scope() {
+			if (begin >= 0)
+				Recorder::global().record(name, category, begin, Recorder::global().now());
+		}
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	};
+}
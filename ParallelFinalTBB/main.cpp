@@ -1,6 +1,8 @@
 #include <iostream>
 #include <cstdio>
+#include <cstring>
 #include <cstdlib>
+#include <string>
 #include <array>
 #include <random>
 #include <cmath>
@@ -8,12 +10,26 @@
 #include <random>
 #include <tuple>
 #include <chrono>
+#include <algorithm>
+#include <memory>
+#include <functional>
 #include <tbb/tbb.h>
 #include <tbb/parallel_reduce.h>
 #include <tbb/parallel_pipeline.h>
 #include <tbb/flow_graph.h>
 #include "bodies.h"
 #include "Matrix.h"
+#include "Reduce.h"
+#include "Stream.h"
+#include "TypedMatrix.h"
+#include "FixedMatrix.h"
+#include "Batch.h"
+#include "Chain.h"
+#include "SparseMatrix.h"
+#include "Factorization.h"
+#include "Vector.h"
+#include "Benchmark.h"
+#include "CommandLine.h"
 
 using namespace tbb::flow;
 
@@ -69,7 +85,7 @@ void example_for_each() {
 	tbb::parallel_for(range, applyOdd);
 }
 
-void pipe_example(int count = 1000) {
+void pipe_example(size_t count = 1000) {
 	double* arr = new double[count];
 	std::random_device rd;  //Will be used to obtain a seed for the random number engine
 	std::mt19937 gen(rd()); //Standard mersenne_twister_engine seeded with rd()
@@ -77,12 +93,13 @@ void pipe_example(int count = 1000) {
 	int max = distr(gen);
 	std::cout << "Random max of " << max << std::endl;
 
-	for (int i = 0; i < count; i++) {
+	for (size_t i = 0; i < count; i++) {
 		arr[i] = (double)(distr(gen) % max);
 	}
 
-	double* first = arr;
-	double *last = arr + count;
+	//Each token carries a chunk of the array, reduced by the pairwise kernel, instead of a single element
+	const size_t chunks = reduce::chunkCount(count);
+	size_t next = 0;
 
 	//Below from TBB docs
 	double sum = 0;
@@ -90,24 +107,33 @@ void pipe_example(int count = 1000) {
 	std::chrono::steady_clock::time_point ts, te;
 	ts = std::chrono::steady_clock::now();
 	tbb::parallel_pipeline( /*max_number_of_live_token=*/16,
-		tbb::make_filter<void, double*>(
+		tbb::make_filter<void, size_t>(
 			tbb::filter_mode::serial_in_order,
-			[&](tbb::flow_control& fc)-> double* {
-				if (first < last) {
-					return first++;
+			[&](tbb::flow_control& fc)-> size_t {
+				trace::Scope stage("tokens", "pipeline");
+				if (next < chunks) {
+					return next++;
 				} else {
 					fc.stop();
-					return nullptr;
+					return 0;
 				}
 			}
 			) &
-		tbb::make_filter<double*, double>(
+		tbb::make_filter<size_t, double>(
 			tbb::filter_mode::parallel,
-			[&count](double* p) {return ((*p) * (*p))/count; }
+			[&](size_t chunk) {
+				trace::Scope stage("sum squares", "pipeline");
+				const size_t first = chunk * reduce::CHUNK;
+				return reduce::pairwiseSum(arr + first, std::min(reduce::CHUNK, count - first),
+					[](double v) { return v * v; }) / count;
+			}
 			) &
 				tbb::make_filter<double, void>(
 					tbb::filter_mode::serial_out_of_order,
-					[&](double x) {sum += x; }
+					[&](double x) {
+						trace::Scope stage("accumulate", "pipeline");
+						sum += x;
+					}
 					)
 				);
 	te = std::chrono::steady_clock::now();
@@ -117,9 +143,16 @@ void pipe_example(int count = 1000) {
 	std::cout << "RMS of random sequence is " << sqrt(sum) << "\n";
 	std::printf("RMS calculation took %dms\n", (int)ms.count());
 
+	ts = std::chrono::steady_clock::now();
+	double rms = reduce::rms(arr, count, Matrix::context());
+	te = std::chrono::steady_clock::now();
+	ms = std::chrono::duration_cast<std::chrono::milliseconds>(te - ts);
+	std::printf("Reduction RMS calculation took %dms\n", (int)ms.count());
+	std::cout << "Reduction " << rms << "\n";
+
 	sum = 0;
 	ts = std::chrono::steady_clock::now();
-	for (int i = 0; i < count; i++) {
+	for (size_t i = 0; i < count; i++) {
 		sum += arr[i] * arr[i];
 	}
 	te = std::chrono::steady_clock::now();
@@ -133,13 +166,17 @@ void pipe_example(int count = 1000) {
 void example_matrix(int size, int iterations) {
 	std::vector<Matrix> matrices;
 
+	std::chrono::steady_clock::time_point ts, te;
+
 	std::printf("Generating random (%dx%d) matrices\n", size, size);
+	ts = std::chrono::steady_clock::now();
 	for (int n = 0; n < iterations; n++) {
 		matrices.push_back(Matrix(size, size, true));
 	}
+	te = std::chrono::steady_clock::now();
+	std::printf("Generation took %dms\n", (int)std::chrono::duration_cast<std::chrono::milliseconds>(te - ts).count());
 
 	Matrix result = matrices[0];
-	std::chrono::steady_clock::time_point ts, te;
 
 	std::printf("Starting %d matrix multiplications\n", iterations);
 	ts = std::chrono::steady_clock::now();
@@ -152,6 +189,887 @@ void example_matrix(int size, int iterations) {
 }
 
 
+void example_simd(int size) {
+	Matrix a(size, size, true);
+	Matrix b(size, size, true);
+	Matrix reference(size, size, false, false);
+
+	//Original scalar loop, used to validate every kernel
+	for (int m = 0; m < size; m++) {
+		for (int n = 0; n < size; n++) {
+			for (int k = 0; k < size; k++) {
+				reference(m, n) += a(m, k) * b(k, n);
+			}
+		}
+	}
+
+	const gemm::Isa detected = gemm::detectIsa();
+	const gemm::Isa isas[] = { gemm::Isa::Scalar, gemm::Isa::SSE2, gemm::Isa::AVX2, gemm::Isa::AVX512 };
+	const double flops = 2.0 * size * size * size;
+	std::printf("Detected %s, (%dx%d) multiplication per kernel\n", gemm::isaName(detected), size, size);
+
+	for (gemm::Isa isa : isas) {
+		if (!gemm::isaSupported(isa)) {
+			std::printf("%-10s not supported\n", gemm::isaName(isa));
+			continue;
+		}
+		gemm::setIsa(isa);
+		Matrix result = a * b; //Warm up
+		std::chrono::steady_clock::time_point ts, te;
+		const int reps = 3;
+		ts = std::chrono::steady_clock::now();
+		for (int r = 0; r < reps; r++) {
+			result = a * b;
+		}
+		te = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(te - ts).count() / reps;
+
+		double err = 0;
+		for (int m = 0; m < size; m++) {
+			for (int n = 0; n < size; n++) {
+				err = std::max(err, std::fabs(result(m, n) - reference(m, n)));
+			}
+		}
+		std::printf("%-10s %8.2f GFLOP/s  max error %g %s\n", gemm::isaName(isa), flops / seconds * 1e-9, err,
+			err < 1e-9 * size ? "OK" : "FAILED");
+	}
+	gemm::setIsa(detected);
+	std::cout << '\n';
+}
+
+
+void example_overhead(int size, int calls) {
+	Matrix a(size, size, true);
+	Matrix b(size, size, true);
+	ExecutionContext& shared = Matrix::context();
+	std::chrono::steady_clock::time_point ts, te;
+
+	std::printf("%d multiplications of (%dx%d) matrices, %d threads\n", calls, size, size, (int)shared.numThreads());
+
+	//Previous behaviour, threads created and joined on every call
+	ts = std::chrono::steady_clock::now();
+	for (int n = 0; n < calls; n++) {
+		ExecutionContext fresh(shared.numThreads());
+		Matrix::setContext(fresh);
+		Matrix result = a * b;
+	}
+	te = std::chrono::steady_clock::now();
+	Matrix::setContext(shared);
+	double freshUs = std::chrono::duration<double, std::micro>(te - ts).count() / calls;
+
+	ts = std::chrono::steady_clock::now();
+	for (int n = 0; n < calls; n++) {
+		Matrix result = a * b;
+	}
+	te = std::chrono::steady_clock::now();
+	double sharedUs = std::chrono::duration<double, std::micro>(te - ts).count() / calls;
+
+	std::printf("Fresh arena per call: %.1fus per multiplication\n", freshUs);
+	std::printf("Shared arena:         %.1fus per multiplication\n\n", sharedUs);
+}
+
+
+void example_expression(int size, int inner) {
+	Matrix a(size, inner, true);
+	Matrix b(inner, size, true);
+	Matrix c(size, inner, true);
+	Matrix d(inner, inner, true);
+	std::chrono::steady_clock::time_point ts, te;
+
+	std::printf("Chain (%dx%d)(%dx%d)(%dx%d)(%dx%d)\n", size, inner, inner, size, size, inner, inner, inner);
+
+	//Left to right, one temporary per product
+	ts = std::chrono::steady_clock::now();
+	Matrix stepwise = a * b;
+	stepwise = stepwise * c;
+	stepwise = stepwise * d;
+	te = std::chrono::steady_clock::now();
+	auto leftToRight = std::chrono::duration_cast<std::chrono::microseconds>(te - ts);
+
+	//Whole chain as one expression, evaluated in the cheapest order into a preallocated destination
+	Matrix chained(size, inner, false, false);
+	ts = std::chrono::steady_clock::now();
+	chained = a * b * c * d;
+	te = std::chrono::steady_clock::now();
+	auto ordered = std::chrono::duration_cast<std::chrono::microseconds>(te - ts);
+
+	double err = 0;
+	for (int i = 0; i < size; i++) {
+		for (int j = 0; j < inner; j++) {
+			err = std::max(err, std::fabs(stepwise(i, j) - chained(i, j)));
+		}
+	}
+	std::printf("Left to right took %dus, chain expression took %dus, max difference %g\n",
+		(int)leftToRight.count(), (int)ordered.count(), err);
+
+	//Element wise parts are fused into one sweep, the product is only evaluated once
+	ts = std::chrono::steady_clock::now();
+	Matrix fused = 0.5 * (c * d) + transpose(b) + (-1.0) * c;
+	te = std::chrono::steady_clock::now();
+	std::printf("0.5*(C*D) + B^T - C took %dus\n\n",
+		(int)std::chrono::duration_cast<std::chrono::microseconds>(te - ts).count());
+}
+
+void example_elementwise(int size) {
+	const Matrix a = Matrix::random(size, size, 1), b = Matrix::random(size, size, 2), c = Matrix::random(size, size, 3);
+	Matrix t(size, size, false, false), naive(size, size, false, false);
+	const double bytes = (double)size * size * sizeof(double);
+	std::chrono::steady_clock::time_point ts, te;
+	auto seconds = [&]() { return std::chrono::duration<double>(te - ts).count(); };
+
+	//Row by row over the destination, every read of a is a new cache line
+	ts = std::chrono::steady_clock::now();
+	Matrix::context().parallelFor(size, [&](int i) {
+		for (int j = 0; j < size; j++)
+			naive(i, j) = a(j, i);
+		});
+	te = std::chrono::steady_clock::now();
+	const double rowWise = seconds();
+	ts = std::chrono::steady_clock::now();
+	t = transpose(a);
+	te = std::chrono::steady_clock::now();
+	double err = 0;
+	for (int i = 0; i < size; i++)
+		for (int j = 0; j < size; j++)
+			err = std::max(err, std::fabs(t(i, j) - naive(i, j)));
+	std::printf("Transpose %dx%d: row wise %.2f GB/s, cache oblivious %.2f GB/s, max difference %g\n", size, size,
+		2 * bytes / rowWise * 1e-9, 2 * bytes / seconds() * 1e-9, err);
+
+	//One pass per operation against the whole expression in one sweep
+	const double alpha = 2, beta = -0.5;
+	Matrix fused(size, size, false, false);
+	ts = std::chrono::steady_clock::now();
+	naive = hadamard(b, c);
+	naive = beta * naive;
+	t = alpha * a;
+	naive = t + naive;
+	te = std::chrono::steady_clock::now();
+	const double separate = seconds();
+	ts = std::chrono::steady_clock::now();
+	fused = alpha * a + beta * hadamard(b, c);
+	te = std::chrono::steady_clock::now();
+	err = 0;
+	for (int i = 0; i < size; i++)
+		for (int j = 0; j < size; j++)
+			err = std::max(err, std::fabs(fused(i, j) - naive(i, j)));
+	std::printf("alpha*A + beta*B.*C: separate passes %.1fms, fused %.1fms (%.2f GB/s), max difference %g\n\n",
+		separate * 1000, seconds() * 1000, 4 * bytes / seconds() * 1e-9, err);
+}
+
+
+void example_multiply_into(int size, int iterations) {
+	std::vector<Matrix> matrices;
+	for (int n = 0; n < iterations; n++) {
+		matrices.push_back(Matrix(size, size, true));
+	}
+	std::chrono::steady_clock::time_point ts, te;
+
+	//result = result * m needs a new buffer every step since the destination is also an operand
+	Matrix result = matrices[0];
+	ts = std::chrono::steady_clock::now();
+	for (int n = 1; n < iterations; n++) {
+		result = result * matrices[n];
+	}
+	te = std::chrono::steady_clock::now();
+	auto assigned = std::chrono::duration_cast<std::chrono::milliseconds>(te - ts);
+
+	//Two buffers swapped every step, nothing is allocated inside the loop
+	Matrix current = matrices[0];
+	Matrix next(size, size, false, false);
+	ts = std::chrono::steady_clock::now();
+	for (int n = 1; n < iterations; n++) {
+		Matrix::multiplyInto(next, current, matrices[n]);
+		std::swap(current, next);
+	}
+	te = std::chrono::steady_clock::now();
+	auto into = std::chrono::duration_cast<std::chrono::milliseconds>(te - ts);
+
+	std::printf("%d multiplications of (%dx%d): assignment %dms, multiplyInto %dms\n",
+		iterations - 1, size, size, (int)assigned.count(), (int)into.count());
+
+	//C = 2 * A^T * B^T + 0.5 * C checked against the expression form
+	const Matrix& a = matrices[0];
+	const Matrix& b = matrices[1];
+	Matrix c = matrices[2];
+	Matrix expected = 2.0 * (transpose(a) * transpose(b)) + 0.5 * c;
+	Matrix::multiplyInto(c, a, b, 2.0, 0.5, true, true);
+	double err = 0;
+	for (int i = 0; i < size; i++) {
+		for (int j = 0; j < size; j++) {
+			err = std::max(err, std::fabs(c(i, j) - expected(i, j)));
+		}
+	}
+	std::printf("Transposed operands with alpha and beta, max difference %g\n\n", err);
+}
+
+
+void example_strassen(int crossover) {
+	const int sizes[] = { 256, 512, 1024, 1536, 2048 };
+	std::chrono::steady_clock::time_point ts, te;
+
+	std::printf("Strassen-Winograd against the blocked kernel, crossover %d\n", crossover);
+	std::printf("%8s %12s %12s %8s %12s\n", "size", "classic ms", "strassen ms", "speedup", "max diff");
+	for (int size : sizes) {
+		Matrix a(size, size, true);
+		Matrix b(size, size, true);
+		Matrix classic(size, size, false, false);
+		Matrix fast(size, size, false, false);
+
+		//Each mode is run once untimed so first touch page faults are not counted
+		strassen::setEnabled(false);
+		Matrix::multiplyInto(classic, a, b);
+		ts = std::chrono::steady_clock::now();
+		Matrix::multiplyInto(classic, a, b);
+		te = std::chrono::steady_clock::now();
+		double classicMs = std::chrono::duration<double, std::milli>(te - ts).count();
+
+		strassen::setEnabled(true, crossover);
+		Matrix::multiplyInto(fast, a, b);
+		ts = std::chrono::steady_clock::now();
+		Matrix::multiplyInto(fast, a, b);
+		te = std::chrono::steady_clock::now();
+		double fastMs = std::chrono::duration<double, std::milli>(te - ts).count();
+		strassen::setEnabled(false);
+
+		double err = 0;
+		for (int i = 0; i < size; i++) {
+			for (int j = 0; j < size; j++) {
+				err = std::max(err, std::fabs(classic(i, j) - fast(i, j)));
+			}
+		}
+		std::printf("%8d %12.1f %12.1f %8.2f %12.3g\n", size, classicMs, fastMs, classicMs / fastMs, err);
+	}
+	std::cout << '\n';
+}
+
+
+void printAllocatorStats(const char* name, const AllocatorStats& stats) {
+	std::printf("%-6s hits %zu, misses %zu, held %.1fMB, in use %.1fMB\n", name, stats.hits, stats.misses,
+		stats.bytesHeld / 1048576.0, stats.bytesInUse / 1048576.0);
+}
+
+void example_allocator(int size, int iterations) {
+	MatrixAllocator& pool = Matrix::allocator();
+	NewAllocator plain;
+	std::chrono::steady_clock::time_point ts, te;
+
+	auto chain = [&]() {
+		Matrix a(size, size, true);
+		Matrix result = a;
+		for (int n = 1; n < iterations; n++) {
+			result = result * a;
+		}
+	};
+
+	Matrix::setAllocator(plain);
+	ts = std::chrono::steady_clock::now();
+	chain();
+	te = std::chrono::steady_clock::now();
+	auto plainMs = std::chrono::duration_cast<std::chrono::milliseconds>(te - ts);
+
+	Matrix::setAllocator(pool);
+	chain(); //Fills the pool
+	ts = std::chrono::steady_clock::now();
+	chain();
+	te = std::chrono::steady_clock::now();
+	auto poolMs = std::chrono::duration_cast<std::chrono::milliseconds>(te - ts);
+
+	std::printf("Chain of %d (%dx%d) multiplications: new/delete %dms, pool %dms\n",
+		iterations, size, size, (int)plainMs.count(), (int)poolMs.count());
+	printAllocatorStats("new", plain.stats());
+	printAllocatorStats("pool", pool.stats());
+	std::cout << '\n';
+}
+
+
+void example_reduce(size_t count) {
+	std::unique_ptr<double[]> arr(new (std::nothrow) double[count]);
+	if (!arr) {
+		std::printf("Not enough memory for %zu elements (%.1fGB), skipped\n\n", count, count * sizeof(double) / 1e9);
+		return;
+	}
+	const uint64_t key = rng::nextStreamKey();
+	Matrix::context().parallelFor(reduce::chunkCount(count), [&](int c) {
+		const size_t first = (size_t)c * reduce::CHUNK;
+		rng::fillUniform(arr.get() + first, (int)std::min(reduce::CHUNK, count - first), first, key, 0, 1);
+		});
+
+	std::chrono::steady_clock::time_point ts, te;
+	auto report = [&](const char* name, double value) {
+		const double ms = std::chrono::duration<double, std::milli>(te - ts).count();
+		std::printf("%-22s %.12g  %8.2fms  %6.2fGB/s\n", name, value, ms, count * sizeof(double) / ms / 1e6);
+	};
+
+	std::printf("%zu elements\n", count);
+	double serial = 0;
+	ts = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count; i++) {
+		serial += arr[i] * arr[i];
+	}
+	te = std::chrono::steady_clock::now();
+	report("Serial RMS", std::sqrt(serial / count));
+
+	ts = std::chrono::steady_clock::now();
+	double rms = reduce::rms(arr.get(), count, Matrix::context());
+	te = std::chrono::steady_clock::now();
+	report("Parallel RMS", rms);
+
+	ts = std::chrono::steady_clock::now();
+	double sum = reduce::sum(arr.get(), count, Matrix::context());
+	te = std::chrono::steady_clock::now();
+	report("Parallel sum", sum);
+
+	ts = std::chrono::steady_clock::now();
+	reduce::Moments moments = reduce::moments(arr.get(), count, Matrix::context());
+	te = std::chrono::steady_clock::now();
+	report("Parallel variance", moments.variance());
+	std::printf("Mean %.12g, variance of U(0, 1) is %.12g\n\n", moments.mean, 1.0 / 12);
+}
+
+
+//Writes count uniform doubles to a file block by block, the data never has to fit in memory
+bool writeRandomFile(const std::string& path, size_t count, uint64_t key) {
+	std::FILE* file = std::fopen(path.c_str(), "wb");
+	if (!file) {
+		std::printf("Could not open %s for writing.\n", path.c_str());
+		return false;
+	}
+	std::vector<double> block(stream::BLOCK);
+	bool ok = true;
+	for (size_t first = 0; first < count && ok; first += stream::BLOCK) {
+		const size_t n = std::min(stream::BLOCK, count - first);
+		Matrix::context().parallelFor(reduce::chunkCount(n), [&](int c) {
+			const size_t offset = (size_t)c * reduce::CHUNK;
+			rng::fillUniform(block.data() + offset, (int)std::min(reduce::CHUNK, n - offset), first + offset, key, 0, 1);
+			});
+		ok = std::fwrite(block.data(), sizeof(double), n, file) == n;
+	}
+	ok = std::fclose(file) == 0 && ok;
+	if (!ok)
+		std::printf("Writing %s failed.\n", path.c_str());
+	return ok;
+}
+
+void example_stream(size_t count) {
+	const std::string path = "stream_example.bin";
+	std::chrono::steady_clock::time_point ts, te;
+
+	ts = std::chrono::steady_clock::now();
+	if (!writeRandomFile(path, count, rng::nextStreamKey()))
+		return;
+	te = std::chrono::steady_clock::now();
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(te - ts);
+	std::printf("Wrote %.1fMB in %dms\n", count * sizeof(double) / 1048576.0, (int)ms.count());
+
+	stream::Stats stats;
+	ts = std::chrono::steady_clock::now();
+	bool ok = stream::statistics(path, stats, stream::BLOCK, stream::LINES, Matrix::context());
+	te = std::chrono::steady_clock::now();
+	std::remove(path.c_str());
+	if (!ok) {
+		std::cout << '\n';
+		return;
+	}
+	const double seconds = std::chrono::duration<double>(te - ts).count();
+	std::printf("Streamed %zu blocks with %zuMB of buffers in %.0fms, %.2fGB/s\n", stats.blocks,
+		stream::LINES * stream::BLOCK * sizeof(double) / 1048576, seconds * 1000, count * sizeof(double) / seconds / 1e9);
+	std::printf("Mean %.12g, variance %.12g, RMS %.12g\n\n", stats.moments.mean, stats.moments.variance(), stats.rms());
+}
+
+
+void example_file(int size) {
+	const std::string path = "matrix_example.pfm";
+	std::chrono::steady_clock::time_point ts, te;
+	auto elapsed = [&]() { return std::chrono::duration<double, std::milli>(te - ts).count(); };
+
+	ts = std::chrono::steady_clock::now();
+	Matrix a(size, size, true);
+	te = std::chrono::steady_clock::now();
+	std::printf("Generating (%dx%d) took %.2fms\n", size, size, elapsed());
+
+	ts = std::chrono::steady_clock::now();
+	bool saved = a.save(path);
+	te = std::chrono::steady_clock::now();
+	if (!saved) {
+		std::cout << "\n\n";
+		return;
+	}
+	std::printf("Saving took %.2fms, %.2fGB/s\n", elapsed(), (double)size * size * sizeof(double) / elapsed() / 1e6);
+
+	ts = std::chrono::steady_clock::now();
+	MappedMatrix mapped = Matrix::map(path);
+	te = std::chrono::steady_clock::now();
+	std::printf("Mapping took %.3fms\n", elapsed());
+
+	ts = std::chrono::steady_clock::now();
+	Matrix loaded = Matrix::load(path);
+	te = std::chrono::steady_clock::now();
+	std::printf("Loading into memory took %.2fms\n", elapsed());
+
+	if (mapped.isValid()) {
+		bool same = loaded.getRows() == size && loaded.getCols() == size;
+		for (int i = 0; i < size && same; i++) {
+			same = std::memcmp(mapped.rowPtr(i), a.rowPtr(i), sizeof(double) * size) == 0
+				&& std::memcmp(loaded.rowPtr(i), a.rowPtr(i), sizeof(double) * size) == 0;
+		}
+		std::printf("Mapped and loaded data %s the original\n", same ? "match" : "do not match");
+
+		//The mapping is used in place as a multiplication operand
+		Matrix product(size, size, false, false);
+		ts = std::chrono::steady_clock::now();
+		Matrix::multiplyViews(gemm::Operand{ mapped.view(), false }, gemm::Operand{ a.view(), false }, product.view());
+		te = std::chrono::steady_clock::now();
+		Matrix expected = a * a;
+		double err = 0;
+		for (int i = 0; i < size; i++) {
+			for (int j = 0; j < size; j++) {
+				err = std::max(err, std::fabs(product(i, j) - expected(i, j)));
+			}
+		}
+		std::printf("Product with the mapped operand took %.2fms, max difference %g\n", elapsed(), err);
+	}
+	mapped = MappedMatrix();
+	std::remove(path.c_str());
+	std::cout << '\n';
+}
+
+
+template<typename T>
+void benchType(const TypedMatrix<T>& a, const TypedMatrix<T>& b, const Matrix& reference, int iterations) {
+	TypedMatrix<T> c(0, 0);
+	TypedMatrix<T>::multiplyInto(c, a, b); //Warm up
+	std::chrono::steady_clock::time_point ts = std::chrono::steady_clock::now();
+	for (int n = 0; n < iterations; n++) {
+		TypedMatrix<T>::multiplyInto(c, a, b);
+	}
+	std::chrono::steady_clock::time_point te = std::chrono::steady_clock::now();
+	const double seconds = std::chrono::duration<double>(te - ts).count() / iterations;
+	const double size = a.getRows();
+
+	Matrix result = c.toMatrix();
+	double err = 0, scale = 0;
+	for (int i = 0; i < result.getRows(); i++) {
+		for (int j = 0; j < result.getCols(); j++) {
+			err = std::max(err, std::fabs(result(i, j) - reference(i, j)));
+			scale = std::max(scale, std::fabs(reference(i, j)));
+		}
+	}
+	std::printf("%-7s %3dB  %7.1fMB  %8.2fms  %7.2f GFLOP/s  max relative error %.2e\n", ElementTraits<T>::name,
+		(int)sizeof(T), 3 * size * size * sizeof(T) / 1048576.0, seconds * 1000, 2 * size * size * size / seconds / 1e9,
+		scale > 0 ? err / scale : err);
+}
+
+void example_types(int size, int iterations) {
+	Matrix a(size, size, true);
+	Matrix b(size, size, true);
+	Matrix reference = a * b;
+
+	std::printf("(%dx%d) products, %d iterations\n", size, size, iterations);
+	benchType(MatrixF64(a), MatrixF64(b), reference, iterations);
+	benchType(MatrixF32(a), MatrixF32(b), reference, iterations);
+	benchType(MatrixBF16(a), MatrixBF16(b), reference, iterations);
+	benchType(MatrixF16(a), MatrixF16(b), reference, iterations);
+
+	//Integers are checked against the product of their own values, which is exact in double at this size
+	MatrixI32 ia(size, size, true);
+	MatrixI32 ib(size, size, true);
+	benchType(ia, ib, ia.toMatrix() * ib.toMatrix(), iterations);
+	std::cout << '\n';
+}
+
+
+template<int N>
+void benchFixed(size_t count) {
+	std::vector<FixedMatrix<N, N>> a(count), b(count), out;
+	const uint64_t keyA = rng::nextStreamKey(), keyB = rng::nextStreamKey();
+	Matrix::context().parallelFor((int)((count + 1023) / 1024), [&](int c) {
+		for (size_t n = (size_t)c * 1024; n < std::min(count, (size_t)(c + 1) * 1024); n++) {
+			a[n] = FixedMatrix<N, N>::random(keyA, n);
+			b[n] = FixedMatrix<N, N>::random(keyB, n);
+		}
+		});
+	std::chrono::steady_clock::time_point ts, te;
+	auto perProduct = [&](size_t products) { return std::chrono::duration<double, std::nano>(te - ts).count() / products; };
+
+	out.resize(count);
+	ts = std::chrono::steady_clock::now();
+	for (size_t n = 0; n < count; n++) {
+		out[n] = a[n] * b[n];
+	}
+	te = std::chrono::steady_clock::now();
+	const double serial = perProduct(count);
+
+	ts = std::chrono::steady_clock::now();
+	batchMultiply(a, b, out);
+	te = std::chrono::steady_clock::now();
+	const double batched = perProduct(count);
+
+	//The dynamic Matrix goes through the blocked engine and the executor for every product
+	const size_t dynamicCount = std::min<size_t>(count, 20000);
+	Matrix da = a[0].toMatrix(), db = b[0].toMatrix(), dc(N, N);
+	ts = std::chrono::steady_clock::now();
+	for (size_t n = 0; n < dynamicCount; n++) {
+		Matrix::multiplyInto(dc, da, db);
+	}
+	te = std::chrono::steady_clock::now();
+	const double dynamic = perProduct(dynamicCount);
+
+	double err = 0;
+	FixedMatrix<N, N> check(dc);
+	for (int i = 0; i < N; i++) {
+		for (int j = 0; j < N; j++) {
+			err = std::max(err, std::fabs(check(i, j) - out[0](i, j)));
+		}
+	}
+	std::printf("%dx%d: Matrix %8.1fns, FixedMatrix %6.1fns, batched %6.1fns per product, difference %g\n",
+		N, N, dynamic, serial, batched, err);
+}
+
+void example_fixed(size_t count) {
+	std::printf("%zu products per size\n", count);
+	benchFixed<3>(count);
+	benchFixed<4>(count);
+	benchFixed<8>(count);
+	std::cout << '\n';
+}
+
+
+void example_batch(int count) {
+	for (int size : { 64, 128, 256 }) {
+		std::vector<Matrix> a, b, sequential, batched;
+		for (int n = 0; n < count; n++) {
+			a.push_back(Matrix(size, size, true));
+			b.push_back(Matrix(size, size, true));
+			sequential.push_back(Matrix(size, size, false, false));
+		}
+		std::chrono::steady_clock::time_point ts, te;
+		const double flops = 2.0 * size * size * size * count;
+
+		//One product after another, each parallel over its own rows only
+		ts = std::chrono::steady_clock::now();
+		for (int n = 0; n < count; n++) {
+			Matrix::multiplyInto(sequential[n], a[n], b[n]);
+		}
+		te = std::chrono::steady_clock::now();
+		const double one = std::chrono::duration<double>(te - ts).count();
+
+		batchMultiply(a, b, batched); //Warm up, allocates the outputs
+		ts = std::chrono::steady_clock::now();
+		batchMultiply(a, b, batched);
+		te = std::chrono::steady_clock::now();
+		const double all = std::chrono::duration<double>(te - ts).count();
+
+		double err = 0;
+		for (int n = 0; n < count; n++) {
+			for (int i = 0; i < size; i++) {
+				for (int j = 0; j < size; j++) {
+					err = std::max(err, std::fabs(batched[n](i, j) - sequential[n](i, j)));
+				}
+			}
+		}
+		std::printf("%d x (%dx%d): one by one %7.2fms %6.2f GFLOP/s, batched %7.2fms %6.2f GFLOP/s, difference %g\n",
+			count, size, size, one * 1000, flops / one / 1e9, all * 1000, flops / all / 1e9, err);
+	}
+	std::cout << '\n';
+}
+
+
+void example_chain(int size, int count) {
+	std::vector<Matrix> factors;
+	for (int n = 0; n < count; n++) {
+		factors.push_back(Matrix(size, size, true));
+	}
+	std::chrono::steady_clock::time_point ts, te;
+
+	ts = std::chrono::steady_clock::now();
+	Matrix sequential = factors[0];
+	for (int n = 1; n < count; n++) {
+		sequential = sequential * factors[n];
+	}
+	te = std::chrono::steady_clock::now();
+	auto sequentialMs = std::chrono::duration_cast<std::chrono::milliseconds>(te - ts);
+
+	ts = std::chrono::steady_clock::now();
+	Matrix tree = chainProduct(factors);
+	te = std::chrono::steady_clock::now();
+	auto treeMs = std::chrono::duration_cast<std::chrono::milliseconds>(te - ts);
+
+	double err = 0, scale = 0;
+	for (int i = 0; i < size; i++) {
+		for (int j = 0; j < size; j++) {
+			err = std::max(err, std::fabs(tree(i, j) - sequential(i, j)));
+			scale = std::max(scale, std::fabs(sequential(i, j)));
+		}
+	}
+	std::printf("Chain of %d (%dx%d): sequential %dms, tree reduction %dms, max relative difference %g\n\n",
+		count, size, size, (int)sequentialMs.count(), (int)treeMs.count(), scale > 0 ? err / scale : err);
+}
+
+
+void example_sparse(int size, int perRow) {
+	//Most rows hold perRow entries, every 64th row is 32 times denser so row counts are uneven
+	std::mt19937 gen(7);
+	std::uniform_int_distribution<int> column(0, size - 1);
+	std::uniform_real_distribution<double> value(-1, 1);
+	auto randomTriplets = [&]() {
+		std::vector<Triplet> triplets;
+		for (int i = 0; i < size; i++) {
+			const int count = i % 64 == 0 ? perRow * 32 : perRow;
+			for (int n = 0; n < count; n++) {
+				triplets.push_back(Triplet{ i, column(gen), value(gen) });
+			}
+		}
+		return triplets;
+	};
+	std::chrono::steady_clock::time_point ts, te;
+
+	ts = std::chrono::steady_clock::now();
+	SparseMatrix a = SparseMatrix::fromTriplets(size, size, randomTriplets());
+	SparseMatrix b = SparseMatrix::fromTriplets(size, size, randomTriplets());
+	te = std::chrono::steady_clock::now();
+	std::printf("Sparse %dx%d, %zu and %zu nonzeros, built from triplets in %dms\n", size, size, a.nonZeros(), b.nonZeros(),
+		(int)std::chrono::duration_cast<std::chrono::milliseconds>(te - ts).count());
+
+	Matrix denseA = a.toDense(), denseB = b.toDense();
+	std::vector<double> x(size);
+	for (double& v : x) {
+		v = value(gen);
+	}
+
+	const int repeats = 100;
+	std::vector<double> y;
+	ts = std::chrono::steady_clock::now();
+	for (int r = 0; r < repeats; r++) {
+		a.multiply(x, y);
+	}
+	te = std::chrono::steady_clock::now();
+	auto spmvUs = std::chrono::duration_cast<std::chrono::microseconds>(te - ts).count() / repeats;
+
+	SparseMatrix csc = a.toCSC();
+	std::vector<double> yc;
+	ts = std::chrono::steady_clock::now();
+	for (int r = 0; r < repeats; r++) {
+		csc.multiply(x, yc);
+	}
+	te = std::chrono::steady_clock::now();
+	auto cscUs = std::chrono::duration_cast<std::chrono::microseconds>(te - ts).count() / repeats;
+
+	double spmvErr = 0;
+	for (int i = 0; i < size; i++) {
+		double sum = 0;
+		const double* row = denseA.rowPtr(i);
+		for (int j = 0; j < size; j++) {
+			sum += row[j] * x[j];
+		}
+		spmvErr = std::max(spmvErr, std::max(std::fabs(sum - y[i]), std::fabs(sum - yc[i])));
+	}
+	std::printf("SpMV: CSR %dus, CSC %dus, max difference to dense %g\n", (int)spmvUs, (int)cscUs, spmvErr);
+
+	ts = std::chrono::steady_clock::now();
+	SparseMatrix c = a * b;
+	te = std::chrono::steady_clock::now();
+	auto spgemmMs = std::chrono::duration_cast<std::chrono::milliseconds>(te - ts);
+
+	ts = std::chrono::steady_clock::now();
+	Matrix dense = denseA * denseB;
+	te = std::chrono::steady_clock::now();
+	auto denseMs = std::chrono::duration_cast<std::chrono::milliseconds>(te - ts);
+
+	Matrix sparseResult = c.toDense();
+	double err = 0;
+	for (int i = 0; i < size; i++) {
+		for (int j = 0; j < size; j++) {
+			err = std::max(err, std::fabs(sparseResult(i, j) - dense(i, j)));
+		}
+	}
+	std::printf("SpGEMM: %dms (%zu nonzeros), dense product %dms, max difference %g\n\n",
+		(int)spgemmMs.count(), c.nonZeros(), (int)denseMs.count(), err);
+}
+
+
+void example_partition() {
+	struct Shape { const char* label; int m, k, n; };
+	const Shape shapes[] = {
+		{ "square", 512, 512, 512 },
+		{ "tall-skinny", 16384, 64, 64 },
+		{ "short-wide", 64, 512, 8192 },
+	};
+	for (const Shape& s : shapes) {
+		partition::TuneResult tuned = Matrix::tune(s.m, s.k, s.n);
+		std::printf("%s %dx%d * %dx%d:", s.label, s.m, s.k, s.k, s.n);
+		for (const partition::Trial& trial : tuned.trials) {
+			std::printf(" %s %.2fms,", partition::describe(trial.policy).c_str(), trial.ms);
+		}
+		partition::Tiling tiles = partition::tiling(s.m, s.n, Matrix::context().numThreads());
+		std::printf("\n  tuned: %s, element-wise tiles %dx%d (%d tiles)\n", partition::describe(tuned.best).c_str(),
+			tiles.tileRows, tiles.tileCols, tiles.count());
+
+		Matrix a(s.m, s.k, true), b(s.k, s.n, true), c(0, 0);
+		std::chrono::steady_clock::time_point ts, te;
+		ts = std::chrono::steady_clock::now();
+		Matrix::multiplyInto(c, a, b, partition::Policy{});
+		te = std::chrono::steady_clock::now();
+		auto defaultUs = std::chrono::duration_cast<std::chrono::microseconds>(te - ts);
+
+		ts = std::chrono::steady_clock::now();
+		Matrix::multiplyInto(c, a, b); //Picks up the tuned policy
+		te = std::chrono::steady_clock::now();
+		auto tunedUs = std::chrono::duration_cast<std::chrono::microseconds>(te - ts);
+		std::printf("  default %dus, tuned (%s) %dus\n", (int)defaultUs.count(),
+			partition::describe(Matrix::policyFor(s.m, s.k, s.n)).c_str(), (int)tunedUs.count());
+	}
+	std::printf("\n");
+}
+
+
+void example_factor(int size) {
+	Matrix a(size, size, true);
+	std::chrono::steady_clock::time_point ts, te;
+	auto ms = [&]() { return std::chrono::duration<double, std::milli>(te - ts).count(); };
+	auto maxDiff = [](const Matrix& x, const Matrix& y) {
+		double err = 0;
+		for (int i = 0; i < x.getRows(); i++)
+			for (int j = 0; j < x.getCols(); j++)
+				err = std::max(err, std::fabs(x(i, j) - y(i, j)));
+		return err;
+	};
+	const double n = size;
+
+	Matrix factors(0, 0);
+	std::vector<int> pivots;
+	ts = std::chrono::steady_clock::now();
+	if (!factor::lu(a, factors, pivots)) {
+		std::cout << '\n';
+		return;
+	}
+	te = std::chrono::steady_clock::now();
+	//P A against L U, with the swaps replayed on a copy of A
+	Matrix lower(size, size), upper(size, size, false, false), permuted = a;
+	for (int i = 0; i < size; i++) {
+		for (int j = 0; j < size; j++) {
+			if (j < i)
+				lower(i, j) = factors(i, j);
+			else
+				upper(i, j) = factors(i, j);
+		}
+		if (pivots[i] != i)
+			std::swap_ranges(permuted.rowPtr(i), permuted.rowPtr(i) + size, permuted.rowPtr(pivots[i]));
+	}
+	std::printf("LU %dx%d in %.1fms, %.2f GFLOP/s, max |PA - LU| %g\n", size, size, ms(),
+		2 * n * n * n / 3 / (ms() * 1e6), maxDiff(permuted, lower * upper));
+
+	Matrix b(size, 1, true), x(0, 0);
+	factor::solve(factors, pivots, b, x);
+	std::printf("Solve, max |Ax - b| %g\n", maxDiff(a * x, b));
+
+	Matrix inverse(0, 0);
+	ts = std::chrono::steady_clock::now();
+	factor::inverse(a, inverse);
+	te = std::chrono::steady_clock::now();
+	std::printf("Inverse in %.1fms, %.2f GFLOP/s, max |A A^-1 - I| %g\n", ms(), 2 * n * n * n / (ms() * 1e6),
+		maxDiff(a * inverse, Matrix(size, size)));
+
+	//A A^T + n I is symmetric positive definite
+	Matrix spd(0, 0), l(0, 0);
+	Matrix::multiplyInto(spd, a, a, 1, 0, false, true);
+	for (int i = 0; i < size; i++)
+		spd(i, i) += size;
+	ts = std::chrono::steady_clock::now();
+	if (!factor::cholesky(spd, l)) {
+		std::cout << '\n';
+		return;
+	}
+	te = std::chrono::steady_clock::now();
+	Matrix product(0, 0);
+	Matrix::multiplyInto(product, l, l, 1, 0, false, true);
+	std::printf("Cholesky in %.1fms, %.2f GFLOP/s, max |LL^T - A| %g\n\n", ms(), n * n * n / 3 / (ms() * 1e6),
+		maxDiff(product, spd));
+}
+
+void example_blas(int size) {
+	const Matrix a = Matrix::random(size, size, 1);
+	const Vector x = Vector::random(size, 2), big = Vector::random(size * size, 3);
+	Vector y(size), other = Vector::random(size * size, 4);
+	const double n = size, elements = n * n;
+	//Best of a few runs, as GB/s of the bytes the kernel has to move
+	auto rate = [](double bytes, auto&& body) {
+		double best = 1e30;
+		for (int r = 0; r < 5; r++) {
+			const auto ts = std::chrono::steady_clock::now();
+			body();
+			best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - ts).count());
+		}
+		return bytes / best * 1e-9;
+	};
+
+	for (bool trans : { false, true }) {
+		const double gbs = rate((elements + 2 * n) * sizeof(double), [&]() { blas::gemv(1, a, x, 0, y, trans); });
+		double err = 0;
+		for (int i = 0; i < size; i++) {
+			double sum = 0;
+			for (int j = 0; j < size; j++)
+				sum += (trans ? a(j, i) : a(i, j)) * x[j];
+			err = std::max(err, std::fabs(sum - y[i]));
+		}
+		std::printf("gemv%s %dx%d: %.2f GB/s, max error %g\n", trans ? "^T" : "  ", size, size, gbs, err);
+	}
+	volatile double sink = 0;
+	std::printf("dot   %9d: %.2f GB/s\n", size * size, rate(2 * elements * sizeof(double), [&]() { sink = blas::dot(big, other); }));
+	std::printf("nrm2  %9d: %.2f GB/s\n", size * size, rate(elements * sizeof(double), [&]() { sink = blas::nrm2(big); }));
+	std::printf("axpy  %9d: %.2f GB/s\n", size * size, rate(3 * elements * sizeof(double), [&]() { blas::axpy(1e-3, big, other); }));
+	std::printf("scal  %9d: %.2f GB/s\n\n", size * size, rate(2 * elements * sizeof(double), [&]() { blas::scal(0.999, other); }));
+}
+
+
+void example_benchmark(const CommandLine& args) {
+	bench::Options options;
+	options.workloads = args.getList("workload", options.workloads);
+	const std::vector<std::string>& known = bench::workloadNames();
+	for (const std::string& workload : options.workloads) {
+		if (std::find(known.begin(), known.end(), workload) == known.end()) {
+			std::string expected;
+			for (const std::string& name : known)
+				expected += (expected.empty() ? "" : ", ") + name;
+			args.addError("--workload expects " + expected + ", got " + workload);
+		}
+	}
+	const std::vector<int> sizes = args.getInts("sizes", {}, 1);
+	if (!sizes.empty()) {
+		options.gemmSizes = options.rmsSizes = options.spmvSizes = options.streamSizes = options.gemvSizes =
+			options.vectorSizes = sizes;
+	}
+	options.threads = args.getInts("threads", {}, 1, 4096);
+	options.repeats = (int)args.getInt("repeats", options.repeats, 1);
+	options.warmup = (int)args.getInt("warmup", options.warmup, 0);
+	options.seed = (uint64_t)args.getInt("seed", (long long)options.seed, 0, INT64_MAX);
+	options.counters = args.has("counters");
+	const std::string format = args.getString("format", "table");
+	if (format != "table" && format != "csv" && format != "json") {
+		args.addError("--format expects table, csv or json, got " + format);
+	}
+	if (!args.ok()) {
+		args.printErrors();
+		std::printf("Run with --help for usage.\n");
+		return;
+	}
+
+	bench::Suite suite(options);
+	suite.run();
+	const std::string output = args.getString("output");
+	if (!output.empty()) {
+		if (suite.write(output, format == "json" ? "json" : "csv")) {
+			std::fprintf(stderr, "Results written to %s\n", output.c_str());
+		}
+	} else if (format == "csv") {
+		suite.writeCSV(stdout);
+	} else if (format == "json") {
+		suite.writeJSON(stdout);
+	} else {
+		suite.print();
+	}
+}
+
+
 int inputRange(std::string prompt, int min, int max)
 {
 	if (min > max) {
@@ -177,34 +1095,227 @@ int inputRange(std::string prompt, int min, int max)
 	return ans;
 }
 
+/// <summary>
+/// Values of --size, --iterations and --count for one run of a command
+/// </summary>
+struct CommandArgs {
+	long long size;
+	long long iterations;
+	long long count;
+	const CommandLine& line;
+};
 
-int main(int argc, char** argv) {
+/// <summary>
+/// Example runnable from the menu or by name from the command line
+/// </summary>
+struct Command {
+	const char* name;
+	const char* title;
+	long long size;        //Defaults of --size, --iterations and --count, -1 where the example takes no such value
+	long long iterations;
+	long long count;
+	std::function<void(const CommandArgs&)> run;
+	bool sweepsThreads;    //Handles --threads itself instead of being rerun per thread count
+	bool largeSize = false; //Takes --size as a size_t, otherwise it is limited to INT32_MAX
+};
+
+std::vector<Command> makeCommands() {
+	return {
+		{ "graph", "Graph example", -1, -1, -1, [](const CommandArgs&) { example_1(); }, false },
+		{ "for-each", "For each example", -1, -1, -1, [](const CommandArgs&) { example_for_each(); }, false },
+		{ "pipe", "Pipe example", 3200000, -1, -1, [](const CommandArgs& a) { pipe_example((size_t)a.size); }, false, true },
+		{ "matrix", "Matrix example", 600, 4, -1, [](const CommandArgs& a) { example_matrix((int)a.size, (int)a.iterations); }, false },
+		{ "simd", "SIMD kernel example", 512, -1, -1, [](const CommandArgs& a) { example_simd((int)a.size); }, false },
+		{ "overhead", "Executor overhead example", 16, 2000, -1, [](const CommandArgs& a) { example_overhead((int)a.size, (int)a.iterations); }, false },
+		{ "expression", "Expression chain example", 600, 20, -1, [](const CommandArgs& a) { example_expression((int)a.size, (int)a.iterations); }, false },
+		{ "elementwise", "Transpose and fused element wise example", 4096, -1, -1, [](const CommandArgs& a) { example_elementwise((int)a.size); }, false },
+		{ "multiply-into", "Multiply into example", 600, 8, -1, [](const CommandArgs& a) { example_multiply_into((int)a.size, (int)a.iterations); }, false },
+		{ "strassen", "Strassen example", 256, -1, -1, [](const CommandArgs& a) { example_strassen((int)a.size); }, false },
+		{ "allocator", "Allocator example", 300, 100, -1, [](const CommandArgs& a) { example_allocator((int)a.size, (int)a.iterations); }, false },
+		{ "reduce", "Reduction example", 0, -1, -1, [](const CommandArgs& a) {
+			//Without --size both the in-cache and the out-of-cache sizes are run
+			if (a.size > 0) {
+				example_reduce((size_t)a.size);
+			} else {
+				example_reduce(3200000);
+				example_reduce(1000000000);
+			}
+			}, false, true },
+		{ "stream", "Streaming example", 64 * 1048576, -1, -1, [](const CommandArgs& a) { example_stream((size_t)a.size); }, false, true },
+		{ "file", "Matrix file example", 2000, -1, -1, [](const CommandArgs& a) { example_file((int)a.size); }, false },
+		{ "types", "Element type example", 1024, 5, -1, [](const CommandArgs& a) { example_types((int)a.size, (int)a.iterations); }, false },
+		{ "fixed", "Fixed size example", 1000000, -1, -1, [](const CommandArgs& a) { example_fixed((size_t)a.size); }, false, true },
+		{ "batch", "Batch example", -1, -1, 64, [](const CommandArgs& a) { example_batch((int)a.count); }, false },
+		{ "chain", "Chain product example", 200, -1, 64, [](const CommandArgs& a) { example_chain((int)a.size, (int)a.count); }, false },
+		{ "sparse", "Sparse matrix example", 2000, -1, 16, [](const CommandArgs& a) { example_sparse((int)a.size, (int)a.count); }, false },
+		{ "factor", "LU, Cholesky and inverse example", 512, -1, -1, [](const CommandArgs& a) { example_factor((int)a.size); }, false },
+		{ "blas", "Vector and gemv example", 4096, -1, -1, [](const CommandArgs& a) { example_blas((int)a.size); }, false },
+		{ "partition", "Partitioning example", -1, -1, -1, [](const CommandArgs&) { example_partition(); }, false },
+		{ "bench", "Benchmark suite", -1, -1, -1, [](const CommandArgs& a) { example_benchmark(a.line); }, true },
+	};
+}
+
+void printUsage() {
+	std::printf("Usage: ParallelFinalTBB [command] [flags]\n\n"
+		"Commands:\n"
+		"  menu                 Interactive menu, the default without a command\n"
+		"  list                 Lists the examples and the values they take\n"
+		"  run NAME...          Runs examples by name, once per --threads value\n"
+		"  bench                Benchmark suite\n"
+		"  help                 This text\n\n"
+		"Flags:\n"
+		"  --threads N[,N...]   Worker threads, a list sweeps them\n"
+		"  --seed N             Seed for random matrices and benchmark inputs\n"
+		"  --backend NAME       Fails unless this build runs NAME (%s)\n"
+		"  --size N, --iterations N, --count N\n"
+		"                       Example parameters, see list for which an example takes\n"
+		"  --workload a,b       Benchmark workloads: gemm, rms, spmv, stream, gemv, gemvt, dot, axpy\n"
+		"  --sizes N[,N...]     Benchmark sizes for every selected workload\n"
+		"  --repeats N, --warmup N\n"
+		"                       Timed and untimed runs of every benchmark case\n"
+		"  --format F           Benchmark output: table, csv or json\n"
+		"  --output PATH        Writes benchmark csv or json to PATH instead of stdout\n"
+		"  --counters           Adds hardware counters (perf_event_open, Linux) to the benchmark output\n"
+		"  --trace PATH         Writes a Chrome trace of the run, open in chrome://tracing or Perfetto\n",
+		ExecutionContext::backendName());
+}
+
+void printCommands(const std::vector<Command>& commands) {
+	for (const Command& c : commands) {
+		std::string params;
+		if (c.size >= 0)
+			params += " --size " + std::to_string(c.size);
+		if (c.iterations >= 0)
+			params += " --iterations " + std::to_string(c.iterations);
+		if (c.count >= 0)
+			params += " --count " + std::to_string(c.count);
+		std::printf("  %-14s %-26s%s\n", c.name, c.title, params.c_str());
+	}
+}
+
+void runMenu(const std::vector<Command>& commands, const CommandLine& args) {
 	int choice = -1;
 	while (choice != 0) {
 		std::cout << "Please select example to run.\n";
 		std::cout << "*****************************\n";
-		std::cout << "Graph example: 1\n"
-			<< "For each example: 2\n"
-			<< "Pipe example: 3\n"
-			<< "Matrix example: 4\n"
-			<< "Exit: 0\n\n";
-		choice = inputRange("Enter: ", 0, 4);
-		switch (choice) {
-		case 1: 
-			example_1();
-			break;
-		case 2:
-			example_for_each();
-			break;
-		case 3:
-			pipe_example(100000);
-			break;
-		case 4:
-			example_matrix(600, 4);
-			break;
-		default:
-			break;
+		for (size_t n = 0; n < commands.size(); n++) {
+			std::cout << commands[n].title << ": " << n + 1 << "\n";
+		}
+		std::cout << "Exit: 0\n\n";
+		choice = inputRange("Enter: ", 0, (int)commands.size());
+		if (choice > 0) {
+			const Command& c = commands[choice - 1];
+			c.run(CommandArgs{ c.size, c.iterations, c.count, args });
+		}
+	}
+}
+
+/// <summary>
+/// Runs the named examples with the values given on the command line, each once per thread count
+/// </summary>
+/// <returns>Process exit code, 2 for usage errors</returns>
+int runCommands(const std::vector<Command>& commands, const std::vector<std::string>& names, const CommandLine& args,
+	const std::vector<int>& threads) {
+	if (names.empty()) {
+		args.addError("run needs at least one example name, see list");
+	}
+	std::vector<std::pair<const Command*, CommandArgs>> runs;
+	for (const std::string& name : names) {
+		auto found = std::find_if(commands.begin(), commands.end(), [&](const Command& c) { return name == c.name; });
+		if (found == commands.end()) {
+			args.addError("unknown example " + name + ", see list");
+			continue;
+		}
+		const Command& c = *found;
+		if (c.size < 0 && args.has("size"))
+			args.addError(std::string(c.name) + " does not take --size");
+		if (c.iterations < 0 && args.has("iterations"))
+			args.addError(std::string(c.name) + " does not take --iterations");
+		if (c.count < 0 && args.has("count"))
+			args.addError(std::string(c.name) + " does not take --count");
+		runs.push_back({ &c, CommandArgs{ args.getInt("size", c.size, 1, c.largeSize ? INT64_MAX : INT32_MAX),
+			args.getInt("iterations", c.iterations, 1), args.getInt("count", c.count, 1), args } });
+	}
+	if (!args.ok()) {
+		args.printErrors();
+		return 2;
+	}
+
+	for (const auto& run : runs) {
+		if (run.first->sweepsThreads || threads.size() <= 1) {
+			run.first->run(run.second);
+			continue;
+		}
+		for (int t : threads) {
+			Matrix::context().setThreads((size_t)t);
+			std::printf("== %s, %d threads ==\n", run.first->name, t);
+			run.first->run(run.second);
 		}
 	}
-	return 0;
-}
\ No newline at end of file
+	//Examples that check their own flags, such as bench, leave their usage errors in args
+	return args.ok() ? 0 : 2;
+}
+
+
+int main(int argc, char** argv) {
+	const CommandLine args(argc, argv, { "help", "counters" });
+	const std::vector<Command> commands = makeCommands();
+	args.allowOnly({ "help", "threads", "seed", "backend", "size", "iterations", "count", "workload", "sizes",
+		"repeats", "warmup", "format", "output", "trace", "counters" });
+
+	const std::string backend = args.getString("backend", ExecutionContext::backendName());
+	if (backend != ExecutionContext::backendName()) {
+		args.addError("this build runs the " + std::string(ExecutionContext::backendName()) + " backend, not " + backend);
+	}
+	const std::vector<int> threads = args.getInts("threads", {}, 1, 4096);
+	if (args.has("seed")) {
+		//Makes the random matrices repeatable between runs
+		rng::setSeed((uint64_t)args.getInt("seed", 0, 0, INT64_MAX));
+	}
+
+	const std::string& command = args.getCommand();
+	if (args.has("help") || command == "help") {
+		printUsage();
+		return 0;
+	}
+	if (!args.ok()) {
+		args.printErrors();
+		std::printf("Run with --help for usage.\n");
+		return 2;
+	}
+	//A single thread count applies to everything, a list is swept by run and by the benchmark suite
+	if (threads.size() == 1) {
+		Matrix::context().setThreads((size_t)threads[0]);
+	}
+
+	if (command != "menu" && command != "list" && command != "run" && command != "bench" && !command.empty()) {
+		std::printf("error: unknown command %s\nRun with --help for usage.\n", command.c_str());
+		return 2;
+	}
+
+	const std::string tracePath = args.getString("trace");
+	if (!tracePath.empty()) {
+		Matrix::context().setTracing(true);
+		trace::Recorder::global().nameThread("main");
+		trace::Recorder::global().start();
+	}
+
+	int status = 0;
+	if (command.empty() || command == "menu") {
+		runMenu(commands, args);
+	} else if (command == "list") {
+		printCommands(commands);
+	} else if (command == "run") {
+		status = runCommands(commands, args.getArguments(), args, threads);
+	} else {
+		status = runCommands(commands, { "bench" }, args, threads);
+	}
+
+	if (!tracePath.empty() && status != 2) {
+		trace::Recorder::global().stop();
+		if (trace::Recorder::global().writeChrome(tracePath)) {
+			std::fprintf(stderr, "Trace written to %s\n", tracePath.c_str());
+		}
+	}
+	return status;
+}